@@ -8,6 +8,11 @@
 #include <complex>
 #include <xmmintrin.h>
 
+// Blocks of at least PAGE_ALIGN_MIN bytes are page-aligned and padded to
+// whole cache lines, so that OpenCL CPU runtimes can use them in place
+// (CL_MEM_USE_HOST_PTR); smaller ones keep the container's alignment.
+#define PAGE_ALIGN_MIN 65536
+
 template<std::size_t alignment>
 struct static_allocator {
     
@@ -18,13 +23,16 @@ struct static_allocator {
         
         if(n > max_size())
             throw std::bad_alloc();
+        const bool page = (n >= PAGE_ALIGN_MIN);
+        if (page)
+            n = (n + 63) & ~(std::size_t)63;
         void* ret =
 #if defined(__GNUC__) || defined (__INTEL_COMPILER)
             _mm_malloc
 #else
             _aligned_malloc
 #endif
-            (n,alignment);
+            (n, (page) ? 4096 : alignment);
         
         if(!ret)
             throw std::bad_alloc();
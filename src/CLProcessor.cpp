@@ -1,25 +1,54 @@
 #include "CLProcessor.hpp"
 #include "NDData.hpp"
 
+#include <algorithm>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
 using namespace codeare::opencl;
 
 
 static const float GB = 1024.*1024.*1024.;
 
-inline static std::pair<const char*, unsigned>
+inline static std::string
 ReadCLFile (const std::string& fname) {
     std::string str, src;
     std::ifstream in;
+    in.open (fname.c_str());
     if(!in)
         std::cerr << "File not found??" << std::endl;
-    in.open (fname.c_str());
     std::getline (in, str);
     while (in) {
         src += str + "\n";
         std::getline (in, str);
     }
     in.close();
-    return std::make_pair(src.c_str(), src.length());
+    return src;
+}
+
+
+inline static double
+WallTime () {
+	timeval tv;
+	gettimeofday (&tv, NULL);
+	return 1.0e3 * tv.tv_sec + 1.0e-3 * tv.tv_usec;
+}
+
+
+/**
+ * @brief 64-bit FNV-1a hash, chained over several strings
+ */
+inline static cl_ulong
+Hash (const std::string& str, cl_ulong h = 14695981039346656037ULL) {
+	for (size_t i = 0; i < str.length(); ++i) {
+		h ^= (unsigned char) str[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
 }
 
 
@@ -71,9 +100,20 @@ CLProcessor::CLProcessor (const std::vector<unsigned short>& devs,
         } catch (const cl::Error&) {}
     }
 
-    if (!devs.empty())
-	    for (unsigned short i = 0; i < devs[0]; ++i)
-	    	_devices.erase(_devices.begin());
+    if (!devs.empty()) { // Keep the listed devices only
+    	std::vector<cl::Device> all = _devices;
+    	_devices.clear();
+    	for (size_t i = 0; i < devs.size(); ++i)
+    		if (devs[i] < all.size())
+    			_devices.push_back(all[devs[i]]);
+    		else
+    			fprintf (stderr, "  WARNING: No device %d.\n", devs[i]);
+    	if (_devices.empty()) {
+    		_status = CL_DEVICE_NOT_FOUND;
+    		fprintf (stderr, "  ERROR: No devices left.\n");
+    		return;
+    	}
+    }
 
     Queue(devs,true);
     DeviceInfo (_devices);
@@ -82,21 +122,44 @@ CLProcessor::CLProcessor (const std::vector<unsigned short>& devs,
 
 
 CLProcessor::~CLProcessor () {
-	_queue.finish();
+	if (!_queue())                            // No device, nothing queued
+		return;
+	try {
+		_queue.finish();
+		if (_staging.empty() && _transfers.empty())
+			return;
+		Sync ();
+		for (size_t i = 0; i < _staging.size(); ++i) // Last owner unmaps
+			if (_staging[i].buf.getInfo<CL_MEM_REFERENCE_COUNT>() == 1)
+				_tqueue.enqueueUnmapMemObject (_staging[i].buf, _staging[i].ptr);
+		_tqueue.finish();
+	} catch (const cl::Error&) {}
 }
 
 
 const int
-CLProcessor::Build (const std::string& ksrc) {
+CLProcessor::Build (const std::string& ksrc, const std::string& options) {
+
+    std::string src = ReadCLFile (ksrc);
+    std::string cfile = CacheFile (src, options);
+    double start = WallTime(), buildms = 0.;
+    _fname = ksrc;
+    fprintf (stderr, "    OpenCL program %s is %d bytes.\n",
+           ksrc.c_str(), (int) src.length());
+
+    if (!cfile.empty() && LoadProgram (cfile, options, buildms)) {
+    	double loadms = WallTime() - start;
+    	fprintf (stderr, "    Loaded     program %s... cache hit (%.1f ms, saved %.1f ms).\n",
+    			options.c_str(), loadms, buildms - loadms);
+    	return CL_SUCCESS;
+    }
 
-    std::pair<const char*, unsigned> kpair = ReadCLFile (ksrc);
-    fprintf (stderr, "    OpenCL program %s is %d bytes.\n    Assembling program ... ",
-           ksrc.c_str(), (int) kpair.second); fflush (stdout);
+    fprintf (stderr, "    Assembling program ... "); fflush (stdout);
     
     try {
-        cl::Program::Sources cps (1, kpair);
+        cl::Program::Sources cps (1, std::make_pair(src.c_str(), src.length()));
         _program = cl::Program(_context, cps);
-        fprintf (stderr, "done.\n    Builing    program ... "); fflush (stdout);
+        fprintf (stderr, "done.\n    Builing    program %s... ", options.c_str()); fflush (stdout);
     } catch (const cl::Error& cle) {
         _status = cle.err();
         fprintf (stderr, "FAILED: %s(%s)\n", cle.what(), StatusStr());
@@ -104,8 +167,15 @@ CLProcessor::Build (const std::string& ksrc) {
     }
     
     try {
-        _status = _program.build(_devices);
-        fprintf (stderr, "done.\n");
+        _status = _program.build(_devices, options.c_str());
+        _programs[options] = _program;
+        if (cfile.empty())
+        	fprintf (stderr, "done.\n");
+        else {
+        	buildms = WallTime() - start;
+        	StoreProgram (cfile, buildms);
+        	fprintf (stderr, "done (cache miss, %.1f ms).\n", buildms);
+        }
     } catch (const cl::Error& cle) {
         _status = cle.err();
         fprintf (stderr, "FAILED. Check logfile!\n");
@@ -122,6 +192,276 @@ CLProcessor::Build (const std::string& ksrc) {
     
 }
 
+/**
+ * @brief Cache compiled programs in dir (created if missing)
+ */
+void CLProcessor::CacheDir (const std::string& dir) {
+	_cache_dir = dir;
+	if (!_cache_dir.empty())
+		mkdir (_cache_dir.c_str(), 0755);
+}
+
+
+/**
+ * @brief Cache file for source and options on the current devices;
+ *        empty if caching is disabled
+ */
+const std::string CLProcessor::CacheFile (const std::string& src, const std::string& options) const {
+
+	if (_cache_dir.empty())
+		return "";
+
+	cl_ulong h = Hash (options, Hash (src));
+	for (size_t i = 0; i < _devices.size(); ++i) {
+		h = Hash (_devices[i].getInfo<CL_DEVICE_NAME>(), h);
+		h = Hash (_devices[i].getInfo<CL_DRIVER_VERSION>(), h);
+	}
+
+	char name[32];
+	snprintf (name, sizeof(name), "/%016llx.bin", (unsigned long long) h);
+	return _cache_dir + name;
+
+}
+
+
+/**
+ * @brief Entries of tuning database file into db (later lines win)
+ */
+inline static void
+ReadTuning (const std::string& file, std::map<std::string, size_t>& db) {
+	std::ifstream in (file.c_str());
+	std::string line;
+	while (std::getline (in, line)) {
+		const size_t tab = line.rfind ('\t');
+		if (line.empty() || line[0] == '#' || tab == std::string::npos)
+			continue;
+		db[line.substr (0, tab)] = strtoul (line.c_str() + tab + 1, NULL, 10);
+	}
+}
+
+
+/**
+ * @brief Tuning database in file (one line per entry: device, driver,
+ *        name, log2 of the problem size and value, tab separated; later
+ *        lines win). Entries are added by Tune and StoreTuned.
+ */
+void CLProcessor::TuneFile (const std::string& file) {
+
+	_tune_file = file;
+	_tuned.clear();
+	ReadTuning (file, _tuned);
+
+}
+
+
+/**
+ * @brief Database key of name for problem size n on the first device;
+ *        sizes are bucketed by powers of two
+ */
+const std::string CLProcessor::TuneKey (const std::string& name, const size_t n) const {
+
+	unsigned bucket = 0;
+	while ((n >> bucket) > 1)
+		++bucket;
+
+	std::stringstream key;
+	key << _devices[0].getInfo<CL_DEVICE_NAME>().c_str() << '\t'
+		<< _devices[0].getInfo<CL_DRIVER_VERSION>().c_str() << '\t'
+		<< name << '\t' << bucket;
+	return key.str();
+
+}
+
+
+/**
+ * @brief Tuned value of name for problem size n, false if none
+ */
+const bool CLProcessor::Tuned (const std::string& name, const size_t n, size_t& value) const {
+	if (_tuned.empty())
+		return false;
+	std::map<std::string, size_t>::const_iterator it = _tuned.find (TuneKey (name, n));
+	if (it == _tuned.end())
+		return false;
+	value = it->second;
+	return true;
+}
+
+
+/**
+ * @brief Add a tuned value to the database and rewrite the file with the
+ *        file's current entries and this one. Processes (MPI ranks) take
+ *        turns through a lock file, and the file is replaced by renaming
+ *        a temporary one, so readers never see it torn.
+ */
+void CLProcessor::StoreTuned (const std::string& name, const size_t n, const size_t value) {
+
+	const std::string key = TuneKey (name, n);
+	_tuned[key] = value;
+	if (_tune_file.empty())
+		return;
+
+#pragma omp critical (tuning)
+	{
+		const int lock = open ((_tune_file + ".lock").c_str(), O_RDWR | O_CREAT, 0644);
+		if (lock >= 0)
+			flock (lock, LOCK_EX);
+
+		std::map<std::string, size_t> db;
+		ReadTuning (_tune_file, db);         // Entries of others since TuneFile
+		db[key] = value;
+
+		std::stringstream tmp;
+		tmp << _tune_file << '.' << getpid();
+		std::ofstream out (tmp.str().c_str());
+		out << "# oclpd tuning: device, driver, kernel, log2 size, work-group size (0: runtime's)\n";
+		for (std::map<std::string, size_t>::const_iterator it = db.begin(); it != db.end(); ++it)
+			out << it->first << '\t' << it->second << '\n';
+		out.close();
+		if (!out || rename (tmp.str().c_str(), _tune_file.c_str())) {
+			fprintf (stderr, "    Could not write tuning file %s.\n", _tune_file.c_str());
+			remove (tmp.str().c_str());
+		}
+
+		if (lock >= 0)
+			close (lock);                    // and unlock
+	}
+
+}
+
+
+/**
+ * @brief Time kern on nkern work-items with the runtime's work-group size
+ *        and the powers of two times the preferred multiple that divide
+ *        nkern, and store the fastest unless the database has an entry.
+ *        kern runs several times, so it must not update its output in place.
+ */
+void CLProcessor::Tune (const cl::Kernel& kern, const size_t nkern, const size_t wsize) {
+
+	std::string name;
+	size_t best = 0, def = 0, pref = 0, kmax = 0;
+
+	try {
+		name = kern.getInfo<CL_KERNEL_FUNCTION_NAME>().c_str();
+		if (Tuned (name, nkern, best))
+			return;
+		def  = WorkGroupSize (kern, wsize);
+		pref = kern.getWorkGroupInfo<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(_devices[0]);
+		kmax = kern.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(_devices[0]);
+	} catch (const cl::Error& cle) {
+		_status = cle.err();
+		fprintf (stderr, "  ERROR(Tune): %s(%d)\n", cle.what(), cle.err());
+		return;
+	}
+
+	std::vector<size_t> lszs (1, 0);         // 0: runtime's choice
+	for (size_t lsz = pref; lsz && lsz <= kmax; lsz *= 2)
+		if (nkern % lsz == 0)
+			lszs.push_back (lsz);
+	if (def && def <= kmax && nkern % def == 0 &&
+			std::find (lszs.begin(), lszs.end(), def) == lszs.end())
+		lszs.push_back (def);
+
+	const int status = _status;
+	double bestms = -1., defms = -1.;
+	for (size_t i = 0; i < lszs.size(); ++i) {
+		double ms = -1.;
+		_status = CL_SUCCESS;
+		for (int r = 0; r < 3 && _status == CL_SUCCESS; ++r) { // Fastest of three
+			const double t = Run (kern, cl::NDRange(nkern),
+					(lszs[i]) ? cl::NDRange(lszs[i]) : cl::NullRange);
+			ms = (ms < 0. || t < ms) ? t : ms;
+		}
+		if (_status != CL_SUCCESS)           // Not launchable with lszs[i]
+			continue;
+		if (lszs[i] == def)
+			defms = ms;
+		if (bestms < 0. || ms < bestms) {
+			best   = lszs[i];
+			bestms = ms;
+		}
+	}
+	_status = status;
+
+	if (bestms < 0.)
+		return;
+	StoreTuned (name, nkern, best);
+	printf ("    Tuned      %s for %zu ... wsize (%zu) (%03.1f ms; default (%zu) %03.1f ms).\n",
+			name.c_str(), nkern, best, bestms, def, defms);
+
+}
+
+
+/**
+ * @brief Create and build _program from cached binaries
+ *
+ * File layout: cl_uint number of devices, double original build time (ms),
+ *              then per device size_t length and binary.
+ */
+bool CLProcessor::LoadProgram (const std::string& cfile, const std::string& options, double& buildms) {
+
+	std::ifstream in (cfile.c_str(), std::ios::binary);
+	if (!in)
+		return false;
+
+	cl_uint ndev = 0;
+	in.read ((char*)&ndev, sizeof(cl_uint));
+	in.read ((char*)&buildms, sizeof(double));
+	if (!in || ndev != _devices.size())
+		return false;
+
+	std::vector<std::string> images (ndev);
+	cl::Program::Binaries binaries;
+	for (cl_uint i = 0; i < ndev; ++i) {
+		size_t len = 0;
+		in.read ((char*)&len, sizeof(size_t));
+		if (!in)
+			return false;
+		images[i].resize (len);
+		in.read (&images[i][0], len);
+		if (!in)
+			return false;
+		binaries.push_back (std::make_pair((const void*)images[i].data(), len));
+	}
+
+	try {
+		cl::Program program (_context, _devices, binaries);
+		program.build (_devices, options.c_str());
+		_program = program;
+		_programs[options] = _program;
+	} catch (const cl::Error& cle) { // Stale or foreign binary: rebuild from source
+		fprintf (stderr, "    Ignoring   cached program %s: %s(%d)\n", cfile.c_str(), cle.what(), cle.err());
+		return false;
+	}
+
+	return true;
+
+}
+
+
+/**
+ * @brief Write _program's binaries to the cache
+ */
+void CLProcessor::StoreProgram (const std::string& cfile, const double buildms) {
+
+	std::vector<size_t> sizes = _program.getInfo<CL_PROGRAM_BINARY_SIZES>();
+	std::vector<char*>  bins  = _program.getInfo<CL_PROGRAM_BINARIES>();
+	cl_uint ndev = sizes.size();
+
+	std::ofstream out (cfile.c_str(), std::ios::binary);
+	out.write ((const char*)&ndev, sizeof(cl_uint));
+	out.write ((const char*)&buildms, sizeof(double));
+	for (cl_uint i = 0; i < ndev; ++i) {
+		out.write ((const char*)&sizes[i], sizeof(size_t));
+		out.write (bins[i], sizes[i]);
+		delete [] bins[i];
+	}
+
+	if (!out)
+		fprintf (stderr, "\n    Could not write program cache %s.\n    ", cfile.c_str());
+
+}
+
+
 cl::Context& CLProcessor::Context () {
     return _context;
 }
@@ -130,10 +470,101 @@ cl::Program& CLProcessor::Program () {
     return _program;
 }
 
+cl::Program& CLProcessor::Program (const std::string& options) {
+	std::map<std::string, cl::Program>::iterator it = _programs.find(options);
+	if (it == _programs.end()) { // Build variant from last source on demand
+		Build (_fname, options);
+		return _programs[options];
+	}
+    return it->second;
+}
+
+cl::Device& CLProcessor::Device () {
+    return _devices[0];
+}
+
+/**
+ * @brief Device shares memory with the host (CPU runtimes, integrated GPUs)
+ */
+const bool CLProcessor::HostUnified () const {
+	return _devices[0].getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>();
+}
+
+const size_t CLProcessor::NDevices () const {
+    return _devices.size();
+}
+
+
+/**
+ * @brief Processor for device d alone: same context and programs, own queue
+ */
+CLProcessor CLProcessor::DeviceProcessor (const size_t d) const {
+
+	CLProcessor cp (*this);
+
+	cp._devices = std::vector<cl::Device> (1, _devices[d]);
+	cp.Queue (std::vector<unsigned short>(), true);
+
+	return cp;
+
+}
+
+
+/**
+ * @brief Replace the first device with n sub-devices of equal compute units
+ *        (one context over all), so that voxel partitioning can be tested
+ *        on a single multi-core CPU.
+ */
+const int CLProcessor::Partition (const unsigned short n) {
+
+	try {
+		cl_uint cus = _devices[0].getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+		cl_device_partition_property props[] =
+			{CL_DEVICE_PARTITION_EQUALLY, std::max(1u, cus/n), 0};
+		std::vector<cl::Device> subdevs;
+		_devices[0].createSubDevices (props, &subdevs);
+		if (subdevs.size() > n)
+			subdevs.resize(n);
+		_devices = subdevs;
+		_context = cl::Context (_devices);
+		_programs.clear();
+	} catch (const cl::Error& cle) {
+		_status = cle.err();
+		fprintf (stderr, "  ERROR(Partition): %s(%d)\n", cle.what(), cle.err());
+		return _status;
+	}
+
+	Queue (std::vector<unsigned short>(), true);
+    DeviceInfo (_devices);
+
+	return _status;
+
+}
+
+const size_t CLProcessor::WorkGroupSize (const cl::Kernel& kern, const size_t wsize) {
+	return wsize * kern.getWorkGroupInfo <CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(_devices[0]);
+}
+
+/**
+ * @brief Work-group size for nkern work-items: the tuned one if the
+ *        database has it and it divides nkern, else WorkGroupSize
+ */
+const size_t CLProcessor::LocalSize (const cl::Kernel& kern, const size_t nkern, const size_t wsize) {
+	size_t lsz = 0;
+	if (Tuned (kern.getInfo<CL_KERNEL_FUNCTION_NAME>().c_str(), nkern, lsz) &&
+			(!lsz || nkern % lsz == 0))
+		return lsz;
+	return WorkGroupSize (kern, wsize);
+}
+
 cl::Kernel CLProcessor::MakeKernel (const std::string& name) {
 	return cl::Kernel (_program, name.c_str());
 }
 
+cl::Kernel CLProcessor::MakeKernel (const std::string& name, const std::string& options) {
+	return cl::Kernel (Program(options), name.c_str());
+}
+
 
 cl::CommandQueue& CLProcessor::Queue (const std::vector<unsigned short>& devs,
 		const bool profiling) {
@@ -141,6 +572,9 @@ cl::CommandQueue& CLProcessor::Queue (const std::vector<unsigned short>& devs,
 	try {
 		_queue = cl::CommandQueue
 				(_context, _devices[0], profiling ? CL_QUEUE_PROFILING_ENABLE : 0, &_status);
+		_tqueue = cl::CommandQueue (_context, _devices[0], 0, &_status);
+		_staging.clear();
+		_transfers.clear();
 	} catch (const cl::Error& cle) {
 		fprintf (stderr, "    Failed to create command queue.\n");
 		_status = cle.err();
@@ -151,30 +585,167 @@ cl::CommandQueue& CLProcessor::Queue (const std::vector<unsigned short>& devs,
 }
 
 
+/**
+ * @brief Free staging buffer of at least size bytes; a buffer is free when
+ *        no transfer since the last Sync uses it. Allocated and mapped once.
+ */
+size_t CLProcessor::Stage (const size_t size) {
+
+	std::vector<bool> busy (_staging.size(), false);
+	for (size_t i = 0; i < _transfers.size(); ++i)
+		if (!_transfers[i].mapped)
+			busy[_transfers[i].stage] = true;
+	for (size_t i = 0; i < _staging.size(); ++i)
+		if (!busy[i] && _staging[i].size >= size)
+			return i;
+
+	Staging s;
+	s.size = size;
+	s.buf  = cl::Buffer (_context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, size);
+	s.ptr  = _tqueue.enqueueMapBuffer (s.buf, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size);
+	_staging.push_back (s);
+
+	return _staging.size() - 1;
+
+}
+
+
+/**
+ * @brief Upload size bytes from src to buf through pinned staging memory;
+ *        returns at once, the event completes with the transfer
+ */
+cl::Event CLProcessor::WriteBytes (const void* src, const size_t size, cl::Buffer& buf) {
+
+	Transfer t;
+
+	try {
+		t.stage  = Stage (size);
+		t.dst    = NULL;
+		t.size   = size;
+		t.mapped = NULL;
+		memcpy (_staging[t.stage].ptr, src, size);
+		_tqueue.enqueueWriteBuffer (buf, CL_FALSE, 0, size, _staging[t.stage].ptr, NULL, &t.event);
+		_tqueue.flush();
+		_transfers.push_back (t);
+	} catch (const cl::Error& cle) {
+		_status = cle.err();
+		fprintf (stderr, "  ERROR(Write): %s(%d)\n", cle.what(), cle.err());
+	}
+
+	return t.event;
+
+}
+
+
+/**
+ * @brief Download size bytes of buf after wait to pinned staging memory;
+ *        returns at once, dst holds the data after Sync
+ */
+cl::Event CLProcessor::ReadBytes (const cl::Buffer& buf, void* dst, const size_t size,
+		const std::vector<cl::Event>* wait) {
+
+	Transfer t;
+
+	try {
+		t.dst    = dst;
+		t.size   = size;
+		t.mapped = NULL;
+		if ((buf.getInfo<CL_MEM_FLAGS>() & CL_MEM_USE_HOST_PTR) &&
+				buf.getInfo<CL_MEM_HOST_PTR>() == dst) { // In place: map for coherence
+			t.stage  = 0;
+			t.buf    = buf;
+			t.mapped = _tqueue.enqueueMapBuffer (buf, CL_FALSE, CL_MAP_READ, 0, size, wait, &t.event);
+			_tqueue.flush();
+			_transfers.push_back (t);
+			return t.event;
+		}
+		t.stage  = Stage (size);
+		_tqueue.enqueueReadBuffer (buf, CL_FALSE, 0, size, _staging[t.stage].ptr, wait, &t.event);
+		_tqueue.flush();
+		_transfers.push_back (t);
+	} catch (const cl::Error& cle) {
+		_status = cle.err();
+		fprintf (stderr, "  ERROR(Read): %s(%d)\n", cle.what(), cle.err());
+	}
+
+	return t.event;
+
+}
+
+
+/**
+ * @brief Wait for all pending transfers and deliver downloads
+ */
+void CLProcessor::Sync () {
+
+	try {
+		for (size_t i = 0; i < _transfers.size(); ++i) {
+			_transfers[i].event.wait();
+			if (_transfers[i].mapped) {
+				if (_transfers[i].mapped != _transfers[i].dst) // Runtime kept a copy
+					memcpy (_transfers[i].dst, _transfers[i].mapped, _transfers[i].size);
+				_tqueue.enqueueUnmapMemObject (_transfers[i].buf, _transfers[i].mapped);
+			} else if (_transfers[i].dst)
+				memcpy (_transfers[i].dst, _staging[_transfers[i].stage].ptr, _transfers[i].size);
+		}
+		_tqueue.finish();
+	} catch (const cl::Error& cle) {
+		_status = cle.err();
+		fprintf (stderr, "  ERROR(Sync): %s(%d)\n", cle.what(), cle.err());
+	}
+
+	_transfers.clear();
+
+}
+
+
+inline static size_t
+NDSize (const cl::NDRange& range) {
+	size_t n = (range.dimensions()) ? 1 : 0;
+	for (size_t i = 0; i < range.dimensions(); ++i)
+		n *= ((const size_t*)range)[i];
+	return n;
+}
+
+
 const double CLProcessor::Run (const cl::Kernel& kern,
 		const size_t nkern, const size_t wsize, const bool profiling) {
 
-	size_t optsize = kern.getWorkGroupInfo <CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(_devices[0]);
+	size_t optsize = 0;
+
+    try {
+        optsize = LocalSize (kern, nkern, wsize);
+    } catch (const cl::Error& cle) {
+    	_status = cle.err();
+        fprintf (stderr, "  ERROR: %s(%d)\n", cle.what(), cle.err());
+        return 0.0;
+    }
+
+    return Run (kern, cl::NDRange(nkern),
+    		(optsize) ? cl::NDRange(optsize) : cl::NullRange, profiling);
+
+}
+
+
+const double CLProcessor::Run (const cl::Kernel& kern,
+		const cl::NDRange& global, const cl::NDRange& local, const bool profiling) {
+
 	double wtime = 0.;
 
     try {
     	if (profiling) {
-    		printf ("    Running  %zu x %s ... ", nkern, kern.getInfo<CL_KERNEL_FUNCTION_NAME>().c_str());
+    		printf ("    Running  %zu x %s ... ", NDSize(global), kern.getInfo<CL_KERNEL_FUNCTION_NAME>().c_str());
     		fflush (stdout);
     	}
         cl::Event event;
 
-        optsize = wsize * kern.getWorkGroupInfo <CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(_devices[0]);
-
-        _queue.enqueueNDRangeKernel (kern, cl::NullRange, cl::NDRange(nkern),
-            		(optsize) ? cl::NDRange(optsize) : cl::NullRange, NULL, &event);
+        _queue.enqueueNDRangeKernel (kern, cl::NullRange, global, local, NULL, &event);
         event.wait();
         _queue.finish();
-    	wtime = 1.0e-6 * (event.getProfilingInfo<CL_PROFILING_COMMAND_END>()
-                - event.getProfilingInfo<CL_PROFILING_COMMAND_START>());
+    	wtime = Elapsed (event);
 
         if (profiling)
-            printf (" wsize (%zu) (%03.1f ms) ... done. \n", optsize, wtime);
+            printf (" wsize (%zu) (%03.1f ms) ... done. \n", NDSize(local), wtime);
 
     } catch (const cl::Error& cle) {
     	_status = cle.err();
@@ -187,6 +758,55 @@ const double CLProcessor::Run (const cl::Kernel& kern,
 }
 
 
+/**
+ * @brief Enqueue without waiting, after the events in wait
+ */
+cl::Event CLProcessor::Enqueue (const cl::Kernel& kern,
+		const size_t nkern, const size_t wsize, const std::vector<cl::Event>* wait) {
+
+	size_t optsize = 0;
+
+    try {
+        optsize = LocalSize (kern, nkern, wsize);
+    } catch (const cl::Error& cle) {
+    	_status = cle.err();
+        fprintf (stderr, "  ERROR: %s(%d)\n", cle.what(), cle.err());
+        return cl::Event();
+    }
+
+    return Enqueue (kern, cl::NDRange(nkern),
+    		(optsize) ? cl::NDRange(optsize) : cl::NullRange, wait);
+
+}
+
+
+cl::Event CLProcessor::Enqueue (const cl::Kernel& kern,
+		const cl::NDRange& global, const cl::NDRange& local, const std::vector<cl::Event>* wait) {
+
+	cl::Event event;
+
+    try {
+        _queue.enqueueNDRangeKernel (kern, cl::NullRange, global, local, wait, &event);
+        _queue.flush();
+    } catch (const cl::Error& cle) {
+    	_status = cle.err();
+        fprintf (stderr, "  ERROR: %s(%d)\n", cle.what(), cle.err());
+    }
+
+    return event;
+
+}
+
+
+/**
+ * @brief Execution time (ms) of a completed command
+ */
+const double CLProcessor::Elapsed (const cl::Event& event) {
+	return 1.0e-6 * (event.getProfilingInfo<CL_PROFILING_COMMAND_END>()
+			- event.getProfilingInfo<CL_PROFILING_COMMAND_START>());
+}
+
+
 const int
 CLProcessor::Status () const {
     return _status;
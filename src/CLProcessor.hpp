@@ -24,9 +24,22 @@ namespace codeare {
             		const cl_device_type dtype = CL_DEVICE_TYPE_DEFAULT);
             ~CLProcessor ();
             const int Status () const;
-            const int Build (const std::string& ksrc);
+            const int Build (const std::string& ksrc, const std::string& options = "");
+            const int Partition (const unsigned short n);
+            void CacheDir (const std::string& dir);
+            void TuneFile (const std::string& file);
+            void Tune (const cl::Kernel& kern, const size_t nkern, const size_t wsize);
+            const bool Tuned (const std::string& name, const size_t n, size_t& value) const;
+            void StoreTuned (const std::string& name, const size_t n, const size_t value);
             const double Run (const cl::Kernel& kern, const size_t nkern,
             		const size_t wsize, const bool profiling = false);
+            const double Run (const cl::Kernel& kern, const cl::NDRange& global,
+            		const cl::NDRange& local, const bool profiling = false);
+            cl::Event Enqueue (const cl::Kernel& kern, const size_t nkern,
+            		const size_t wsize, const std::vector<cl::Event>* wait = NULL);
+            cl::Event Enqueue (const cl::Kernel& kern, const cl::NDRange& global,
+            		const cl::NDRange& local, const std::vector<cl::Event>* wait = NULL);
+            static const double Elapsed (const cl::Event& event);
 
             const char* StatusStr ();
 
@@ -34,39 +47,136 @@ namespace codeare {
 
             cl::Program& Program();
 
+            cl::Program& Program(const std::string& options);
+
+            cl::Device& Device();
+
+            const size_t NDevices () const;
+
+            CLProcessor DeviceProcessor (const size_t d) const;
+
+            const size_t WorkGroupSize (const cl::Kernel& kern, const size_t wsize);
+
+            const size_t LocalSize (const cl::Kernel& kern, const size_t nkern, const size_t wsize);
+
             cl::CommandQueue& Queue(const std::vector<unsigned short>& devs, const bool profiling);
 
             cl::Kernel  MakeKernel (const std::string& name);
 
+            cl::Kernel  MakeKernel (const std::string& name, const std::string& options);
+
+            cl::Event WriteBytes (const void* src, const size_t size, cl::Buffer& buf);
+
+            cl::Event ReadBytes (const cl::Buffer& buf, void* dst, const size_t size,
+            		const std::vector<cl::Event>* wait = NULL);
+
+            void Sync ();
+
+            const bool HostUnified () const;
+
+            /**
+             * @brief Host data of size bytes is used in place: host-unified
+             *        device and page-aligned storage
+             */
+            inline bool InPlace (const size_t size) const {
+            	return size >= PAGE_ALIGN_MIN && HostUnified();
+            }
+
+            /**
+             * @brief Create a read-only buffer and upload data without waiting.
+             *        Host-unified devices use data in place (null event).
+             */
+            template<class T> cl::Event
+            Write (NDData<T>& data, cl::Buffer& buf) {
+            	if (InPlace (data.Size()*sizeof(T))) {
+            		buf = Buffer (data, CL_MEM_READ_ONLY);
+            		return cl::Event();
+            	}
+            	buf = cl::Buffer (_context, CL_MEM_READ_ONLY, data.Size()*sizeof(T));
+            	return WriteBytes (data.Ptr(), data.Size()*sizeof(T), buf);
+            }
+
+            /**
+             * @brief Device buffer for data's size; on host-unified devices
+             *        backed by data itself if page-aligned (see Allocator.hpp),
+             *        and Read maps it in place instead of transferring
+             */
+            template<class T> cl::Buffer
+            Buffer (NDData<T>& data, const cl_mem_flags flags = CL_MEM_READ_WRITE) {
+            	const size_t size = data.Size()*sizeof(T);
+            	if (InPlace (size))                   // Whole cache lines of the allocation
+            		return cl::Buffer (_context, flags | CL_MEM_USE_HOST_PTR,
+            				(size + 63) & ~(size_t)63, data.Ptr());
+            	return cl::Buffer (_context, flags, size);
+            }
+
+            /**
+             * @brief Download after wait without waiting; data is valid after Sync
+             */
+            template<class T> cl::Event
+            Read (const cl::Buffer& buf, NDData<T>& data, const std::vector<cl::Event>* wait = NULL) {
+            	return ReadBytes (buf, data.Ptr(), data.Size()*sizeof(T), wait);
+            }
+
             template<class T> const int
             Copy (NDData<T>& data, cl::Buffer& buf) {
-            	buf = cl::Buffer (_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-            			data.Size()*sizeof(T), data.Ptr());
+            	cl::Event event = Write (data, buf);
+            	if (event())
+            		event.wait();
+            	return _status;
             }
 
             template<class T> const int
-            Copy (const cl::Buffer& buf, NDData<T>& data){
-            	size_t sf = sizeof(cl_float);
-            	cl::CommandQueue queue;
-            	try{
-            	    queue = cl::CommandQueue(_context, _devices[0], 0, &_status);
-            		queue.enqueueReadBuffer(buf, CL_TRUE, 0, data.Size()*sizeof(T), data.Ptr());
-            	} catch (const cl::Error& cle) {
-            	    printf("ERROR: %s(%d)\n", cle.what(), cle.err());
-            	    _status = cle.err();
-            	}
-            	queue.finish();
+            Copy (const cl::Buffer& buf, NDData<T>& data, const std::vector<cl::Event>* wait = NULL){
+            	Read (buf, data, wait);
+            	Sync ();
             	return _status;
             }
 
         protected:
 
+            /**
+             * @brief Pinned host memory, mapped for the processor's lifetime
+             */
+            struct Staging {
+            	cl::Buffer buf;
+            	void*      ptr;
+            	size_t     size;
+            };
+
+            /**
+             * @brief Transfer in flight; reads are copied to dst on Sync,
+             *        or unmapped if buf maps dst in place
+             */
+            struct Transfer {
+            	cl::Event  event;
+            	size_t     stage;
+            	void*      dst;
+            	size_t     size;
+            	cl::Buffer buf;
+            	void*      mapped;
+            };
+
+            size_t Stage (const size_t size);
+
+            bool LoadProgram (const std::string& cfile, const std::string& options, double& buildms);
+            void StoreProgram (const std::string& cfile, const double buildms);
+            const std::string CacheFile (const std::string& src, const std::string& options) const;
+            const std::string TuneKey (const std::string& name, const size_t n) const;
+
             std::string _fname;
+            std::string _cache_dir; /**!< Program binary cache, disabled if empty */
+            std::string _tune_file; /**!< Tuning database, disabled if empty */
+            std::map<std::string, size_t> _tuned; /**!< Tuned values by TuneKey */
             std::vector<cl::Device>  _devices;
             cl::Context              _context;
             cl::Program              _program;    /**!<   */
+            std::map<std::string, cl::Program> _programs; /**!< Builds by option string */
         	cl::Event _event;
         	cl::CommandQueue _queue;
+        	cl::CommandQueue _tqueue;           /**!< Transfers */
+        	std::vector<Staging>  _staging;     /**!< Staging pool */
+        	std::vector<Transfer> _transfers;   /**!< Pending until Sync */
 
             int                      _status;  // error code returned from api calls
             
@@ -0,0 +1,210 @@
+#include "CoilCompression.hpp"
+
+#include <algorithm>
+#include <math.h>
+#include <sys/time.h>
+
+using namespace codeare::shm;
+
+typedef std::complex<float>  cplx;
+typedef std::complex<double> dcplx;
+
+
+inline static double
+WallTime () {
+	timeval tv;
+	gettimeofday (&tv, NULL);
+	return 1.0e3 * tv.tv_sec + 1.0e-3 * tv.tv_usec;
+}
+
+
+CoilCompression::CoilCompression (const cplx* b1, const unsigned nr, const unsigned nc) :
+		_nc (nc), _nv (nc), _gram (nc*nc, cplx(0.f)), _ms (0.) {
+
+	double start = WallTime();
+
+#pragma omp parallel
+	{
+		std::vector<dcplx> lg (nc*nc, dcplx(0.));
+
+#pragma omp for schedule(static)
+		for (long v = 0; v < (long)nr; ++v)
+			for (unsigned b = 0; b < nc; ++b) {
+				const dcplx bb = b1[v+(size_t)b*nr];
+				for (unsigned a = 0; a <= b; ++a)
+					lg[a+b*nc] += std::conj (dcplx (b1[v+(size_t)a*nr])) * bb;
+			}
+
+#pragma omp critical
+		for (unsigned b = 0; b < nc; ++b)
+			for (unsigned a = 0; a <= b; ++a)
+				_gram[a+b*nc] += cplx (lg[a+b*nc]);
+	}
+
+	for (unsigned b = 0; b < nc; ++b)        // Hermitian
+		for (unsigned a = b+1; a < nc; ++a)
+			_gram[a+b*nc] = std::conj (_gram[b+a*nc]);
+
+	_ms = WallTime() - start;
+
+}
+
+
+float* CoilCompression::Gram () {
+	return (float*) &_gram[0];
+}
+
+
+/*
+ * Cyclic Jacobi on the Hermitian Gram matrix: each (p,q) is made real
+ * by a phase on q and zeroed by a plane rotation
+ */
+unsigned CoilCompression::Decompose (const float keep) {
+
+	double start = WallTime();
+
+	const unsigned n = _nc;
+	std::vector<dcplx> a (_gram.begin(), _gram.end()), v (n*n, dcplx(0.));
+	for (unsigned i = 0; i < n; ++i)
+		v[i*(n+1)] = 1.;
+
+	double total = 0.;
+	for (unsigned i = 0; i < n*n; ++i)
+		total += std::norm (a[i]);
+
+	for (unsigned sweep = 0; sweep < 64; ++sweep) {
+
+		double off = 0.;
+		for (unsigned q = 0; q < n; ++q)
+			for (unsigned p = 0; p < q; ++p)
+				off += std::norm (a[p+q*n]);
+		if (off <= 1.0e-24 * total)
+			break;
+
+		for (unsigned q = 1; q < n; ++q)
+			for (unsigned p = 0; p < q; ++p) {
+
+				const double apq = std::abs (a[p+q*n]);
+				if (apq == 0.)
+					continue;
+
+				const dcplx ph = std::conj (a[p+q*n]) / apq;    // a_pq -> |a_pq|
+				for (unsigned k = 0; k < n; ++k) {
+					a[k+q*n] *= ph;
+					v[k+q*n] *= ph;
+				}
+				for (unsigned k = 0; k < n; ++k)
+					a[q+k*n] *= std::conj (ph);
+
+				const double th = .5 * atan2 (2.*apq, a[q+q*n].real() - a[p+p*n].real()),
+						     c  = cos (th), s = sin (th);
+				for (unsigned k = 0; k < n; ++k) {               // A R, V R
+					const dcplx akp = a[k+p*n], akq = a[k+q*n],
+							    vkp = v[k+p*n], vkq = v[k+q*n];
+					a[k+p*n] = c*akp - s*akq;
+					a[k+q*n] = s*akp + c*akq;
+					v[k+p*n] = c*vkp - s*vkq;
+					v[k+q*n] = s*vkp + c*vkq;
+				}
+				for (unsigned k = 0; k < n; ++k) {               // R^T A
+					const dcplx apk = a[p+k*n], aqk = a[q+k*n];
+					a[p+k*n] = c*apk - s*aqk;
+					a[q+k*n] = s*apk + c*aqk;
+				}
+
+			}
+
+	}
+
+	std::vector<std::pair<double,unsigned> > order (n);
+	for (unsigned i = 0; i < n; ++i)
+		order[i] = std::make_pair (-a[i*(n+1)].real(), i);
+	std::sort (order.begin(), order.end());
+
+	_ev.resize (n);
+	_v.resize  (n*n);
+	double sum = 0., acc = 0.;
+	for (unsigned i = 0; i < n; ++i) {
+		_ev[i] = std::max (0., -order[i].first);
+		sum   += _ev[i];
+		const dcplx* vi = &v[order[i].second*n];
+		double vmax = 0.;                    // Gauge: first major component real
+		for (unsigned k = 0; k < n; ++k)
+			vmax = std::max (vmax, std::abs (vi[k]));
+		unsigned km = 0;
+		while (std::abs (vi[km]) < .5*vmax)
+			++km;
+		const dcplx ph = (vmax > 0.) ? std::conj (vi[km]) / std::abs (vi[km]) : 1.;
+		for (unsigned k = 0; k < n; ++k)
+			_v[k+i*n] = cplx (vi[k] * ph);
+	}
+
+	if (keep >= 1.f)
+		_nv = std::min (n, (unsigned) keep);
+	else
+		for (_nv = 0; _nv < n && (acc < keep * sum || !_nv); ++_nv)
+			acc += _ev[_nv];
+
+	_ms += WallTime() - start;
+
+	return _nv;
+
+}
+
+
+void CoilCompression::Compress (const cplx* b1, const unsigned nr, cplx* vb1) const {
+
+	double start = WallTime();
+
+#pragma omp parallel for schedule(static)
+	for (long v = 0; v < (long)nr; ++v)
+		for (unsigned j = 0; j < _nv; ++j) {
+			cplx acc = 0.f;
+			for (unsigned c = 0; c < _nc; ++c)
+				acc += b1[v+(size_t)c*nr] * _v[c+j*_nc];
+			vb1[v+(size_t)j*nr] = acc;
+		}
+
+	_ms += WallTime() - start;
+
+}
+
+
+void CoilCompression::Expand (const cplx* v, const unsigned nc, const unsigned nv,
+		const cplx* vrf, const unsigned nk, cplx* rf) {
+
+	for (unsigned c = 0; c < nc; ++c)
+		for (unsigned t = 0; t < nk; ++t) {
+			cplx acc = 0.f;
+			for (unsigned j = 0; j < nv; ++j)
+				acc += v[c+j*nc] * vrf[t+j*nk];
+			rf[t+c*nk] = acc;
+		}
+
+}
+
+
+const cplx* CoilCompression::Vectors () const {
+	return &_v[0];
+}
+
+
+unsigned CoilCompression::Virtual () const {
+	return _nv;
+}
+
+
+double CoilCompression::Energy () const {
+	double kept = 0., sum = 0.;
+	for (unsigned i = 0; i < _ev.size(); ++i) {
+		sum += _ev[i];
+		if (i < _nv)
+			kept += _ev[i];
+	}
+	return (sum > 0.) ? kept/sum : 1.;
+}
+
+
+const double CoilCompression::Time () const {
+	return _ms;
+}
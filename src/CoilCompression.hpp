@@ -0,0 +1,78 @@
+#ifndef __COIL_COMPRESSION_HPP__
+#define __COIL_COMPRESSION_HPP__
+
+#include <complex>
+#include <vector>
+#include <cstddef>
+
+/**
+ * @brief Transmit coil compression: the principal virtual channels of the
+ *        b1 maps (SVD over voxels through the nc x nc Gram matrix)
+ */
+namespace codeare {
+    namespace shm {
+
+        class CoilCompression {
+
+            typedef std::complex<float> cplx;
+
+        public:
+
+            /**
+             * @brief Accumulate the Gram matrix b1^H b1 (nc x nc) in parallel
+             *
+             * @param b1  Sensitivities (nr x nc)
+             */
+            CoilCompression (const cplx* b1, const unsigned nr, const unsigned nc);
+
+            /**
+             * @brief Gram matrix (2*nc*nc floats), to be summed over MPI ranks
+             *        before Decompose
+             */
+            float* Gram ();
+
+            /**
+             * @brief Eigen decomposition of the Gram matrix
+             *
+             * @param  keep  Virtual channels (>= 1) or retained b1 energy (< 1)
+             * @return       Virtual channels
+             */
+            unsigned Decompose (const float keep);
+
+            /**
+             * @brief Virtual sensitivities vb1 = b1 V (nr x Virtual())
+             */
+            void Compress (const cplx* b1, const unsigned nr, cplx* vb1) const;
+
+            /**
+             * @brief Physical rf = V vrf (nk x nc) of virtual rf (nk x nv)
+             *
+             * @param v  Virtual channels (nc x nv, see Vectors)
+             */
+            static void Expand (const cplx* v, const unsigned nc, const unsigned nv,
+            		const cplx* vrf, const unsigned nk, cplx* rf);
+
+            /**
+             * @brief Virtual channels as combinations of the physical (nc x Virtual())
+             */
+            const cplx* Vectors () const;
+
+            unsigned Virtual () const;
+            double Energy () const;      /**!< Retained fraction of |b1|_F^2 */
+            const double Time () const;  /**!< Gram, decomposition and compression in ms */
+
+        private:
+
+            unsigned _nc;                 /**!< Physical channels */
+            unsigned _nv;                 /**!< Virtual channels */
+            std::vector<cplx>   _gram;    /**!< b1^H b1 */
+            std::vector<cplx>   _v;       /**!< Eigenvectors, column major, descending */
+            std::vector<double> _ev;      /**!< Eigenvalues, descending */
+            mutable double _ms;
+
+        };
+
+    }
+}
+
+#endif //__COIL_COMPRESSION_HPP__
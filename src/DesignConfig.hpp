@@ -0,0 +1,77 @@
+#ifndef __DESIGN_CONFIG_HPP__
+#define __DESIGN_CONFIG_HPP__
+
+#include "Container.hpp"
+
+#include <string>
+
+/**
+ * @brief   Order of the voxels in memory and on the NDRange
+ */
+enum VoxelOrder {
+
+  LOADED,  /**< @brief As in the input file */
+  MORTON,  /**< @brief Morton (Z-order) curve through the positions */
+  HILBERT  /**< @brief Hilbert curve through the positions */
+
+};
+
+/**
+ * @brief Algorithmic choices for the pulse design
+ */
+struct DesignConfig {
+
+    /**
+     * @brief Defaults reproduce the original time reversal path
+     */
+    DesignConfig () : verbose(false), check(false), fused(false), tree(false),
+    		precess(false), spinor(false), scan(false), scanauto(false), specialise(false),
+    		async(false), planar(false), rftime(false), constg(false), vpi(0), tune(false), engine(OCL), iterations(0), tolerance(1.0e-3), matrix(256),
+    		lambda(1.0e-4), nufft(false), segments(0),
+    		compress(0.), compact(true), order(LOADED) {}
+
+    /**
+     * @brief OpenCL build options for kernel variants chosen at build time
+     */
+    inline std::string BuildOptions () const {
+    	std::string opts;
+    	if (precess)
+    		opts += "-DPRECESS ";
+    	if (spinor)
+    		opts += "-DSPINOR ";
+    	if (planar)
+    		opts += "-DPLANAR ";
+    	if (rftime)
+    		opts += "-DRFTIME ";
+    	return opts;
+    }
+
+    bool verbose; /**< Verbose output */
+    bool check;   /**< Cross-check against the reference kernels */
+    bool fused;   /**< Fused acquisition and reduction (no nc*nk*nr signal buffer) */
+    bool tree;    /**< Hierarchical work-group reduction of the signals */
+    bool precess; /**< Closed-form z-rotation in the acquisition (no rotmn) */
+    bool spinor;  /**< Spinor propagation in the excitation (no per-step matrix) */
+    bool scan;    /**< Parallel-in-time kernels */
+    bool scanauto; /**< Parallel-in-time kernels below SCAN_VOXELS_PER_CU voxels per compute unit */
+    bool specialise; /**< Build kernels for the data's nc, nk and dt */
+    bool async;   /**< Event-chained kernels, synchronised at download only */
+    bool planar;  /**< Voxel vectors planar (x[], y[], z[]) on the device */
+    bool rftime;  /**< Time-major RF (channels of a step contiguous) in the excitation */
+    bool constg;  /**< Trajectory and Jacobian in constant memory if they fit */
+    unsigned vpi; /**< Voxels per work-item in simacq and simexc (0: by device) */
+    bool tune;    /**< Time work-group sizes and vpi missing from the tuning file */
+    Engine engine; /**< OpenCL, native shared memory or MPI */
+    unsigned iterations; /**< CGNR refinement of the time reversal (0: none) */
+    float tolerance;     /**< CGNR stops at |r|/|d| below */
+    unsigned matrix;     /**< MB for an explicit system matrix instead of CGNR by simulation (0: never) */
+    float lambda;        /**< Tikhonov weight of the system matrix solvers */
+    bool nufft;          /**< Least squares design with NUFFT operators on the host */
+    unsigned segments;   /**< NUFFT time segments for b0 (0: automatic) */
+    float compress;      /**< Virtual transmit channels (>= 1) or retained b1 energy (< 1), 0: off */
+    bool compact;        /**< Only voxels with m0 or tm0 are launched (off: --dense) */
+    VoxelOrder order;    /**< Voxels reordered along a space-filling curve at load */
+
+};
+
+#endif //__DESIGN_CONFIG_HPP__
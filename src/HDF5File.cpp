@@ -74,6 +74,51 @@ HDF5File& HDF5File::operator= (const HDF5File& h5io) {
 
 }
 
+void HDF5File::SelectRange (H5::DataSpace& space, const codeare::container<hsize_t>& dims,
+		const size_t d, codeare::container<hsize_t>& start, const hsize_t a, const hsize_t e,
+		bool& first) {
+
+	if (a >= e)
+		return;
+
+	hsize_t rsz = 1;                         // Elements per index of dimension d
+	for (size_t k = d+1; k < dims.size(); ++k)
+		rsz *= dims[k];
+
+	hsize_t i0 = a/rsz;
+	const hsize_t i1 = e/rsz, ra = a%rsz, re = e%rsz;
+
+	if (i0 == i1) {                          // Within one index of d
+		start[d] = i0;
+		SelectRange (space, dims, d+1, start, ra, re, first);
+		return;
+	}
+
+	if (ra) {                                // Leading partial
+		start[d] = i0++;
+		SelectRange (space, dims, d+1, start, ra, rsz, first);
+	}
+
+	if (i1 > i0) {                           // Whole indices [i0,i1) of d
+		codeare::container<hsize_t> count (dims.size(), 1);
+		start[d] = i0;
+		count[d] = i1 - i0;
+		for (size_t k = d+1; k < dims.size(); ++k) {
+			start[k] = 0;
+			count[k] = dims[k];
+		}
+		space.selectHyperslab ((first) ? H5S_SELECT_SET : H5S_SELECT_OR, count.ptr(), start.ptr());
+		first = false;
+	}
+
+	if (re) {                                // Trailing partial
+		start[d] = i1;
+		SelectRange (space, dims, d+1, start, 0, re, first);
+	}
+
+}
+
+
 H5::Group HDF5File::CreateGroup (const std::string& url) {
     
 	size_t depth = 0,
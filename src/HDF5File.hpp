@@ -126,7 +126,9 @@ public:
 
 			H5::DataSpace dspace (data.NDim() + ((Complex) ? 1 : 0), dims.ptr());
 			H5::FloatType dtype  (H5Traits<T>::H5Type());
-			H5::DataSet   dset = group.createDataSet(urn, dtype, dspace);
+			H5::DSetCreatPropList dprop;   // No timestamps: identical runs, identical files
+			H5Pset_obj_track_times (dprop.getId(), false);
+			H5::DataSet   dset = group.createDataSet(urn, dtype, dspace, dprop);
 
 			dset.write(data.Ptr(), dtype);
 			dset.close();
@@ -207,6 +209,108 @@ public:
         return Read<T> (std::string(urn), std::string(url));
     }
 
+
+	/**
+	 * @brief     Read a hyperslab: nblk blocks of cnt elements at off, off+stride, ...
+	 *            of the flattened data set. Elements beyond its end are zero.
+	 *
+	 * @param  data   Data container (nblk*cnt)
+	 * @param  off    Offset of first block
+	 * @param  cnt    Elements per block
+	 * @param  nblk   Number of blocks
+	 * @param  stride Distance of blocks
+	 */
+	template<class T> IOStatus
+	Read (NDData<T>& data, const std::string& urn, const std::string& url, const size_t off,
+			const size_t cnt, const size_t nblk = 1, const size_t stride = 0) {
+
+		try {
+
+#ifndef VERBOSE
+			H5::Exception::dontPrint();
+#endif
+			H5::DataSet   dset   = this->_file.openDataSet(URI(url,urn));
+			H5::FloatType dtype  (H5Traits<T>::H5Type());
+			H5::DataSpace dspace = dset.getSpace();
+			const hsize_t nf     = (H5Traits<T>::Complex) ? 2 : 1; // Floats per element
+			const hsize_t npts   = dspace.getSimpleExtentNpoints();
+
+			codeare::container<hsize_t> dims (dspace.getSimpleExtentNdims());
+			codeare::container<hsize_t> start (dims.size(), 0);
+			dspace.getSimpleExtentDims(&dims[0], NULL);
+			data         = NDData<T> (nblk*cnt);
+
+			for (size_t b = 0; b < nblk; ++b) {
+				const hsize_t a = std::min (npts, nf*(off + b*stride)),
+						      e = std::min (npts, nf*(off + b*stride + cnt));
+				if (a == e)
+					continue;
+				const hsize_t n = e - a;
+				bool first = true;
+				H5::DataSpace mspace (1, &n);
+				SelectRange (dspace, dims, 0, start, a, e, first);
+				dset.read(data.Ptr() + b*cnt, dtype, mspace, dspace);
+				mspace.close();
+			}
+
+			dspace.close();
+			dset.close();
+
+		} catch (const H5::FileIException&      e) {
+			return ReportException (e, HDF5_FILE_I_EXCEPTION);
+		} catch (const H5::DataSetIException&   e) {
+			return ReportException (e, HDF5_DATASET_I_EXCEPTION);
+		} catch (const H5::DataSpaceIException& e) {
+			return ReportException (e, HDF5_DATASPACE_I_EXCEPTION);
+		} catch (const H5::DataTypeIException&  e) {
+			return ReportException (e, HDF5_DATATYPE_I_EXCEPTION);
+		}
+
+		return OK;
+
+	}
+
+
+	/**
+	 * @brief     Dimensions of a data set without reading it
+	 *
+	 * @param  urn Name
+	 * @param  url Group
+	 * @return     Dimensions as Read would give them
+	 */
+	template<class T> codeare::container<size_t>
+	Dims (const std::string& urn, const std::string& url = "/") {
+
+		codeare::container<hsize_t> dims;
+
+		try {
+
+#ifndef VERBOSE
+			H5::Exception::dontPrint();
+#endif
+			H5::DataSet   dset   = this->_file.openDataSet(URI(url,urn));
+			H5::DataSpace dspace = dset.getSpace();
+
+			dims = codeare::container<hsize_t> (dspace.getSimpleExtentNdims());
+			dspace.getSimpleExtentDims(&dims[0], NULL);
+			if (H5Traits<T>::Complex)
+				dims.pop_back();
+			std::reverse (dims.begin(),dims.end());
+			dspace.close();
+			dset.close();
+
+		} catch (const H5::FileIException&      e) {
+			ReportException (e, HDF5_FILE_I_EXCEPTION);
+		} catch (const H5::DataSetIException&   e) {
+			ReportException (e, HDF5_DATASET_I_EXCEPTION);
+		} catch (const H5::DataSpaceIException& e) {
+			ReportException (e, HDF5_DATASPACE_I_EXCEPTION);
+		}
+
+		return (codeare::container<size_t>) dims;
+
+	}
+
 	const IOStatus
 	FileAccess    ();
 
@@ -218,6 +322,15 @@ private:
 	H5::Group CreateGroup (const std::string& url);
 
 
+	/**
+	 * @brief Add the flat element range [a,e) of the sub-array dims[d..] at
+	 *        start[0..d) to the selection of space
+	 */
+	static void SelectRange (H5::DataSpace& space, const codeare::container<hsize_t>& dims,
+			const size_t d, codeare::container<hsize_t>& start, const hsize_t a, const hsize_t e,
+			bool& first);
+
+
 	/**
 	 * 	@brief Handle HDF5 exceptions
 	 *
@@ -9,16 +9,19 @@
 #define INPUTPARSER_HPP_
 
 #include "Options.hpp"
+#include "DesignConfig.hpp"
 #define __CL_ENABLE_EXCEPTIONS
 #include "cl.hpp"
 
 #include <vector>
 #include <exception>
+#include <sstream>
 
 static const bool
-ParseInput (int args, char** argv, bool& verbose, bool& query,
-		cl_device_type& cldtype, std::vector<unsigned short>& devs,
-		std::string& code_uri, std::string& din_uri, std::string& dout_uri) {
+ParseInput (int args, char** argv, bool& query,
+		cl_device_type& cldtype, std::vector<unsigned short>& devs, unsigned short& nsub,
+		std::string& code_uri, std::string& din_uri, std::string& dout_uri,
+		std::string& cache_uri, DesignConfig& conf) {
 
 	char* tmp;
 	Options opts;
@@ -35,9 +38,38 @@ ParseInput (int args, char** argv, bool& verbose, bool& query,
 	opts.addUsage  (" -v, --verbose     Verbose output");
 	opts.addUsage  (" -q, --query-devs  Query devices");
 	opts.addUsage  (" -u, --use-devs    List of devices to be used (-q first?)");
+	opts.addUsage  (" -n, --sub-devs    Split the first device into n sub-devices");
+	opts.addUsage  (" -m, --engine      ocl (default), shm: native threads, no OpenCL, or");
+	opts.addUsage  ("                   mpi: voxel slabs on MPI ranks (run with mpirun -np N)");
 	opts.addUsage  (" -c, --code-file   Complete path (default: src/opencl/sim.cl)");
 	opts.addUsage  (" -i  --data-in     Input data (default: data/r1.h5)");
 	opts.addUsage  (" -o  --data-out    Output data (default: out.h5)");
+	opts.addUsage  (" -b  --bin-cache   Program binary cache and tuning file in dir (default: none)");
+	opts.addUsage  (" -f, --fused       Fused acquisition and reduction (low memory)");
+	opts.addUsage  (" -t, --tree        Hierarchical work-group signal reduction");
+	opts.addUsage  (" -p, --precess     Closed-form precession in acquisition");
+	opts.addUsage  (" -s, --spinor      Spinor propagation in excitation");
+	opts.addUsage  (" -a, --scan        Parallel-in-time kernels");
+	opts.addUsage  ("     --scan-auto   -a if fewer than 32 voxels per compute unit (opt-in: unmeasured)");
+	opts.addUsage  (" -k, --specialise  Kernels built for the data's nc, nk and dt");
+	opts.addUsage  (" -e, --async       Event-chained kernels, one sync at download");
+	opts.addUsage  ("     --planar      Planar voxel vectors r, gs, m0 and m on the device");
+	opts.addUsage  ("     --rf-time     Time-major RF in the excitation (constant memory if it fits)");
+	opts.addUsage  ("     --const-g     Trajectory g and Jacobian j in constant memory if they fit");
+	opts.addUsage  ("     --vpi         Voxels per work-item, 1, 4, 8 or 16 (default: by device)");
+	opts.addUsage  ("     --tune        Time work-group sizes and vpi missing from the tuning file (-b)");
+	opts.addUsage  (" -l, --iterations  CGNR iterations on the device (default: 0)");
+	opts.addUsage  (" -r, --tolerance   CGNR relative residual (default: 1e-3)");
+	opts.addUsage  (" -g, --matrix      MB for an explicit system matrix, used with -l");
+	opts.addUsage  ("                   when cheaper than simulation (default: 256, 0: never)");
+	opts.addUsage  (" -w, --lambda      Tikhonov weight of the system matrix (default: 1e-4)");
+	opts.addUsage  (" -z, --nufft       NUFFT operators on the host for -l (voxels on a lattice)");
+	opts.addUsage  (" -j, --segments    NUFFT time segments for b0 (default: 0, automatic)");
+	opts.addUsage  (" -y, --compress    Transmit coil compression to n virtual channels (n >= 1)");
+	opts.addUsage  ("                   or to a retained b1 energy (< 1, f.e. 0.99)");
+	opts.addUsage  (" -d, --dense       Launch empty voxels too (no compaction to m0 or tm0)");
+	opts.addUsage  (" -O, --order       Voxels along a morton or hilbert curve (default: as loaded)");
+	opts.addUsage  (" -x, --cross-check Compare against reference kernels");
 	opts.addUsage  ("");
 	opts.addUsage  (" -h, --help    Print this help screen");
 	opts.addUsage  ("");
@@ -49,10 +81,36 @@ ParseInput (int args, char** argv, bool& verbose, bool& query,
 	opts.setFlag   ("help"       , 'h');
 	opts.setFlag   ("verbose"    , 'v');
 	opts.setFlag   ("query-devs" , 'q');
+	opts.setOption ("engine"     , 'm');
 	opts.setOption ("code-file"  , 'c');
 	opts.setOption ("data-in"    , 'i');
 	opts.setOption ("data-out"   , 'o');
+	opts.setOption ("bin-cache"  , 'b');
 	opts.setOption ("user-devs"  , 'u');
+	opts.setOption ("sub-devs"   , 'n');
+	opts.setOption ("iterations" , 'l');
+	opts.setOption ("tolerance"  , 'r');
+	opts.setOption ("matrix"     , 'g');
+	opts.setOption ("lambda"     , 'w');
+	opts.setOption ("segments"   , 'j');
+	opts.setOption ("compress"   , 'y');
+	opts.setOption ("order"      , 'O');
+	opts.setOption ("vpi");
+	opts.setFlag   ("fused"      , 'f');
+	opts.setFlag   ("tree"       , 't');
+	opts.setFlag   ("precess"    , 'p');
+	opts.setFlag   ("spinor"     , 's');
+	opts.setFlag   ("scan"       , 'a');
+	opts.setFlag   ("scan-auto");
+	opts.setFlag   ("specialise" , 'k');
+	opts.setFlag   ("async"      , 'e');
+	opts.setFlag   ("planar");
+	opts.setFlag   ("rf-time");
+	opts.setFlag   ("const-g");
+	opts.setFlag   ("tune");
+	opts.setFlag   ("cross-check", 'x');
+	opts.setFlag   ("nufft"      , 'z');
+	opts.setFlag   ("dense"      , 'd');
 
 	opts.processCommandArgs(args, argv);
 
@@ -64,17 +122,78 @@ ParseInput (int args, char** argv, bool& verbose, bool& query,
 	code_uri.assign ((tmp = opts.getValue("code-file")) ? tmp : "");
     din_uri.assign  ((tmp = opts.getValue("data-in"))   ? tmp : "");
     dout_uri.assign ((tmp = opts.getValue("data-out"))  ? tmp : "");
-    verbose               = opts.getFlag("verbose");
+    cache_uri.assign((tmp = opts.getValue("bin-cache")) ? tmp : "");
+    conf.verbose          = opts.getFlag("verbose");
+    conf.fused            = opts.getFlag("fused");
+    conf.tree             = opts.getFlag("tree");
+    conf.precess          = opts.getFlag("precess");
+    conf.spinor           = opts.getFlag("spinor");
+    conf.scan             = opts.getFlag("scan");
+    conf.scanauto         = opts.getFlag("scan-auto");
+    conf.specialise       = opts.getFlag("specialise");
+    conf.async            = opts.getFlag("async");
+    conf.planar           = opts.getFlag("planar");
+    conf.rftime           = opts.getFlag("rf-time");
+    conf.constg           = opts.getFlag("const-g");
+    conf.tune             = opts.getFlag("tune");
+    conf.check            = opts.getFlag("cross-check");
+    conf.nufft            = opts.getFlag("nufft");
+    conf.compact          = !opts.getFlag("dense");
     query                 = opts.getFlag("query-devs");
-    tmp = opts.getValue("user-devs");
+    if ((tmp = opts.getValue("iterations")))
+    	conf.iterations = (unsigned) atoi (tmp);
+    if ((tmp = opts.getValue("tolerance")))
+    	conf.tolerance  = (float) atof (tmp);
+    if ((tmp = opts.getValue("matrix")))
+    	conf.matrix     = (unsigned) atoi (tmp);
+    if ((tmp = opts.getValue("lambda")))
+    	conf.lambda     = (float) atof (tmp);
+    if ((tmp = opts.getValue("segments")))
+    	conf.segments   = (unsigned) atoi (tmp);
+    if ((tmp = opts.getValue("compress")))
+    	conf.compress   = (float) atof (tmp);
+    tmp = opts.getValue("order");
     if (tmp) {
-		try {
-			devs.push_back((unsigned short)atoi(std::string(tmp).c_str()));
-		} catch (const std::exception& e) {
-			fprintf (stderr, "oclpd: device list must be comma seperated list of positive integers. f.e. -u 0,1\n");
+    	if (std::string(tmp) == "morton")
+    		conf.order = MORTON;
+    	else if (std::string(tmp) == "hilbert")
+    		conf.order = HILBERT;
+    	else {
+			fprintf (stderr, "oclpd: order must be morton or hilbert.\n");
+			return false;
+    	}
+    }
+    if ((tmp = opts.getValue("vpi"))) {
+    	conf.vpi = (unsigned) atoi (tmp);
+    	if (conf.vpi != 1 && conf.vpi != 4 && conf.vpi != 8 && conf.vpi != 16) {
+			fprintf (stderr, "oclpd: vpi must be 1, 4, 8 or 16.\n");
 			return false;
+    	}
+    }
+    tmp = opts.getValue("engine");
+    if (tmp) {
+    	if (std::string(tmp) == "shm")
+    		conf.engine = SHM;
+    	else if (std::string(tmp) == "mpi")
+    		conf.engine = MPI;
+    	else if (std::string(tmp) != "ocl") {
+			fprintf (stderr, "oclpd: engine must be ocl, shm or mpi.\n");
+			return false;
+    	}
+    }
+    tmp = opts.getValue("user-devs");
+    if (tmp) {
+		std::stringstream list (tmp);
+		std::string dev;
+		while (std::getline (list, dev, ',')) {
+			if (dev.empty() || dev.find_first_not_of("0123456789") != std::string::npos) {
+				fprintf (stderr, "oclpd: device list must be comma seperated list of positive integers. f.e. -u 0,1\n");
+				return false;
+			}
+			devs.push_back((unsigned short)atoi(dev.c_str()));
 		}
     }
+    nsub = (tmp = opts.getValue("sub-devs")) ? (unsigned short)atoi(tmp) : 0;
 
 	return true;
 
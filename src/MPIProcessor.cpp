@@ -0,0 +1,93 @@
+#include "MPIProcessor.hpp"
+
+#include <algorithm>
+#include <vector>
+#include <sys/time.h>
+
+#ifdef HAVE_MPI
+#define OMPI_SKIP_MPICXX  // No C++ bindings: namespace MPI clashes with Engine MPI
+#define MPICH_SKIP_MPICXX
+#include <mpi.h>
+#endif
+
+using namespace codeare::mpi;
+
+
+inline static double
+WallTime () {
+	timeval tv;
+	gettimeofday (&tv, NULL);
+	return 1.0e3 * tv.tv_sec + 1.0e-3 * tv.tv_usec;
+}
+
+
+MPIProcessor::MPIProcessor (int* args, char*** argv) : _rank (0), _size (1) {
+#ifdef HAVE_MPI
+	MPI_Init (args, argv);
+	MPI_Comm_rank (MPI_COMM_WORLD, &_rank);
+	MPI_Comm_size (MPI_COMM_WORLD, &_size);
+#endif
+}
+
+
+MPIProcessor::~MPIProcessor () {
+#ifdef HAVE_MPI
+	MPI_Finalize ();
+#endif
+}
+
+
+const int MPIProcessor::Rank () const {
+	return _rank;
+}
+
+
+const int MPIProcessor::Size () const {
+	return _size;
+}
+
+
+void MPIProcessor::Barrier () const {
+#ifdef HAVE_MPI
+	MPI_Barrier (MPI_COMM_WORLD);
+#endif
+}
+
+
+void MPIProcessor::Partition (const unsigned nr, unsigned& v0, unsigned& nv) const {
+	v0 = (unsigned) ((size_t)nr *  _rank    / _size);
+	nv = (unsigned) ((size_t)nr * (_rank+1) / _size) - v0;
+}
+
+
+const double MPIProcessor::AllReduce (float* data, const size_t n) const {
+	double start = WallTime();
+#ifdef HAVE_MPI
+	MPI_Allreduce (MPI_IN_PLACE, data, (int)n, MPI_FLOAT, MPI_SUM, MPI_COMM_WORLD);
+#endif
+	return WallTime() - start;
+}
+
+
+void MPIProcessor::Gather (const float* part, const size_t n, float* whole) const {
+#ifdef HAVE_MPI
+	int cnt = (int) n;
+	std::vector<int> cnts (_size), offs (_size, 0);
+	MPI_Gather (&cnt, 1, MPI_INT, &cnts[0], 1, MPI_INT, 0, MPI_COMM_WORLD);
+	for (int r = 1; r < _size; ++r)
+		offs[r] = offs[r-1] + cnts[r-1];
+	MPI_Gatherv ((void*)part, cnt, MPI_FLOAT, whole, &cnts[0], &offs[0], MPI_FLOAT, 0,
+			MPI_COMM_WORLD);
+#else
+	std::copy (part, part + n, whole);
+#endif
+}
+
+
+const double MPIProcessor::Max (const double val) const {
+	double ret = val;
+#ifdef HAVE_MPI
+	MPI_Reduce ((void*)&val, &ret, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+#endif
+	return ret;
+}
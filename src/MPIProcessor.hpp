@@ -0,0 +1,60 @@
+#ifndef __MPI_PROCESSOR_HPP__
+#define __MPI_PROCESSOR_HPP__
+
+#include <cstddef>
+
+/**
+ * @brief Distributed memory engine: ranks of MPI_COMM_WORLD, each designing
+ *        a contiguous slab of voxels. Without MPI (HAVE_MPI undefined) a
+ *        single rank.
+ */
+namespace codeare {
+    namespace mpi {
+
+        class MPIProcessor {
+
+        public:
+
+            MPIProcessor (int* args = 0, char*** argv = 0);
+
+            ~MPIProcessor ();
+
+            const int Rank () const;
+
+            const int Size () const;
+
+            void Barrier () const;
+
+            /**
+             * @brief Voxels [v0, v0+nv) of this rank out of nr
+             */
+            void Partition (const unsigned nr, unsigned& v0, unsigned& nv) const;
+
+            /**
+             * @brief Sum of data (n floats) over all ranks, in place
+             *
+             * @return Time in ms
+             */
+            const double AllReduce (float* data, const size_t n) const;
+
+            /**
+             * @brief Concatenation of every rank's part (n floats) on rank 0
+             */
+            void Gather (const float* part, const size_t n, float* whole) const;
+
+            /**
+             * @brief Maximum of val over all ranks on rank 0
+             */
+            const double Max (const double val) const;
+
+        protected:
+
+            int _rank; /**!< This rank */
+            int _size; /**!< Number of ranks */
+
+        };
+
+    }
+}
+
+#endif //__MPI_PROCESSOR_HPP__
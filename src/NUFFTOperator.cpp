@@ -0,0 +1,489 @@
+#include "NUFFTOperator.hpp"
+#include "Solvers.hpp"
+
+#include <algorithm>
+#include <math.h>
+#include <sys/time.h>
+
+using namespace codeare::nufft;
+
+typedef std::complex<float>  cplx;
+typedef std::complex<double> dcplx;
+
+static const int      KW     = 6;        // Kernel width in grid points
+static const unsigned MAXSEG = 64;
+static const unsigned NBINS  = 256;      // Off-resonance histogram
+static const float    GAMMA  = 42.57748f;
+static const float    TWOPI  = 6.283185307179586476925286766559005768394338798750211641949889185f;
+
+
+inline static double
+WallTime () {
+	timeval tv;
+	gettimeofday (&tv, NULL);
+	return 1.0e3 * tv.tv_sec + 1.0e-3 * tv.tv_usec;
+}
+
+
+/*
+ * Modified Bessel function of the first kind, order 0
+ */
+inline static double
+I0 (const double x) {
+	double ret = 1., term = 1.;
+	for (unsigned k = 1; term > 1.0e-12 * ret; ++k) {
+		term *= (.25*x*x) / ((double)k*k);
+		ret  += term;
+	}
+	return ret;
+}
+
+
+/*
+ * Kaiser-Bessel kernel at x (grid points) and its Fourier transform at f
+ * (cycles per grid point), both relative to the kernel's peak
+ */
+inline static double
+KB (const double x, const double beta) {
+	const double a = 2.*x/KW;
+	return (fabs(a) < 1.) ? I0 (beta*sqrt(1.-a*a)) / I0 (beta) : 0.;
+}
+
+inline static double
+KBHat (const double f, const double beta) {
+	const double a = beta*beta - M_PI*M_PI*KW*KW*f*f;
+	const double s = sqrt (fabs(a));
+	return KW * ((a > 0.) ? sinh(s)/s : (s > 0.) ? sin(s)/s : 1.) / I0 (beta);
+}
+
+
+NUFFTOperator::NUFFTOperator (const float* b1, const float* g, const float* r, const float* b0,
+		const float* gs, const float* m0, const std::vector<unsigned>& vox,
+		const unsigned nr, const unsigned nc, const unsigned nk, const float dt,
+		const unsigned segments) :
+		_nv (vox.size()), _nx ((size_t)nc*nk), _nc (nc), _nk (nk), _nl (1), _ok (false),
+		_frob (0.), _applyms (0.), _ng (1) {
+
+	double start = WallTime();
+
+	const double gdt = GAMMA * TWOPI * dt;
+	const double rdt = 1.0e-3 * dt * TWOPI;
+
+	unsigned n[3], c[3];
+	double   x0[3], h[3], beta[3];
+	std::vector<int> nv (3*_nv);             // Lattice index per voxel
+
+	_setupms = 0.;
+	_k[0] = _k[1] = _k[2] = 1;
+	if (!_nv)
+		return;
+
+	for (unsigned d = 0; d < 3; ++d) {       // Lattice of r*gs
+
+		std::vector<double> x (_nv);
+		for (size_t i = 0; i < _nv; ++i)
+			x[i] = (double)r[3*vox[i]+d] * gs[3*vox[i]+d];
+		std::sort (x.begin(), x.end());
+
+		const double ext = x.back() - x.front(), eps = 1.0e-6 * std::max (1., fabs(x.front()));
+		x0[d] = x.front();
+		h[d]  = ext;
+		for (size_t i = 1; i < _nv; ++i)
+			if (x[i] - x[i-1] > eps)
+				h[d] = std::min (h[d], x[i] - x[i-1]);
+		n[d] = (ext > eps) ? (unsigned) floor (ext/h[d] + .5) + 1 : 1;
+		if (n[d] > 1)                        // Spacing from the extent, robust to rounding
+			h[d] = ext / (n[d]-1);
+		if (n[d] > 4096)
+			return;
+
+		for (size_t i = 0; i < _nv; ++i) {
+			const double s = (n[d] > 1) ? ((double)r[3*vox[i]+d]*gs[3*vox[i]+d] - x0[d]) / h[d] : 0.;
+			nv[3*i+d] = (int) floor (s + .5);
+			if (fabs (s - nv[3*i+d]) > 1.0e-3)
+				return;
+		}
+
+		c[d]  = n[d]/2;                      // Centre
+		_k[d] = 1;
+		if (n[d] > 1)                        // Oversampled at least twice
+			while (_k[d] < std::max<unsigned> (2*n[d], 2*KW))
+				_k[d] *= 2;
+		const double sigma = (double)_k[d]/n[d];
+		beta[d] = M_PI * sqrt (KW*KW/(sigma*sigma) * (sigma-.5)*(sigma-.5) - .8);
+		_ng    *= _k[d];
+
+		_rev[d].resize (_k[d]);              // FFT tables
+		_tw[d].resize (_k[d]/2);
+		for (unsigned j = 0, bits = 0; j < _k[d]; ++j) {
+			while ((1u << bits) < _k[d])
+				++bits;
+			unsigned rj = 0;
+			for (unsigned b = 0; b < bits; ++b)
+				rj |= ((j >> b) & 1) << (bits-1-b);
+			_rev[d][j] = rj;
+		}
+		for (unsigned j = 0; j < _k[d]/2; ++j)
+			_tw[d][j] = std::polar (1.f, -TWOPI*j/_k[d]);
+
+	}
+
+	std::vector<double> om (_nv), tau (_nk), kap (3*_nk), taul;
+	std::vector<cplx>   bt;
+
+	for (size_t i = 0; i < _nv; ++i)
+		om[i] = gdt * rdt * b0[vox[i]];
+
+	double kt[3] = {0., 0., 0.}, tt = 0.;    // k-space and time as seen by stafwd
+	for (int t = nk-1; t >= 0; --t) {
+		for (unsigned d = 0; d < 3; ++d) {
+			kap[3*t+d] = kt[d] + .5*g[3*t+d];
+			kt[d]     += g[3*t+d];
+		}
+		tau[t] = tt + .5*t;
+		tt    += t;
+	}
+
+	const double mean = Segment (om, tau, segments, bt, taul);
+
+	_j0.resize (3*_nk);                      // Kernel per time point
+	_w.resize  (3*_nk*KW);
+	_st.resize (_nl*_nk);
+	for (unsigned t = 0; t < _nk; ++t) {
+		double ph = 0.;
+		for (unsigned d = 0; d < 3; ++d) {
+			float* w = &_w[(3*t+d)*KW];
+			ph += gdt * kap[3*t+d] * x0[d];
+			if (n[d] == 1) {
+				_j0[3*t+d] = 0;
+				std::fill (w, w+KW, 0.f);
+				w[0] = 1.f;
+				continue;
+			}
+			const double u = gdt * h[d] * kap[3*t+d];    // Radians per lattice step
+			double s = u * _k[d] / (2.*M_PI);
+			s -= _k[d] * floor (s/_k[d]);
+			ph += u * c[d];
+			_j0[3*t+d] = (int) floor (s - .5*KW) + 1;
+			for (int a = 0; a < KW; ++a)
+				w[a] = KB (_j0[3*t+d] + a - s, beta[d]);
+		}
+		const cplx pre = std::polar (1.f, (float) - fmod (ph, 2.*M_PI));
+		for (unsigned l = 0; l < _nl; ++l)
+			_st[l*_nk+t] = bt[l*_nk+t] * pre;
+	}
+
+	_gv.resize (_nv);                        // Voxel side
+	_sv.resize (_nl*_nv);
+	_b1.resize (_nc*_nv);
+	double frob = 0.;
+	for (size_t i = 0; i < _nv; ++i) {
+		const size_t pos = vox[i];
+		double dap = 1.;
+		size_t gi = 0, stride = 1;
+		for (unsigned d = 0; d < 3; ++d) {
+			const int nd = nv[3*i+d] - (int)c[d];
+			if (n[d] > 1)
+				dap *= KBHat ((double)nd/_k[d], beta[d]);
+			gi     += (size_t)(nd & (int)(_k[d]-1)) * stride;
+			stride *= _k[d];
+		}
+		_gv[i] = gi;
+		const double a = rdt * m0[3*pos+2];
+		for (unsigned l = 0; l < _nl; ++l)
+			_sv[l*_nv+i] = std::polar ((float)(a/dap), (float) fmod ((om[i]-mean)*taul[l], 2.*M_PI));
+		double s = 0.;
+		for (unsigned ch = 0; ch < _nc; ++ch) {
+			_b1[ch*_nv+i] = cplx (b1[2*(pos+(size_t)ch*nr)], b1[2*(pos+(size_t)ch*nr)+1]);
+			s += std::norm (_b1[ch*_nv+i]);
+		}
+		frob += a*a*s*_nk;
+	}
+
+	_frob    = frob;
+	_ok      = true;
+	_setupms = WallTime() - start;
+
+}
+
+
+/*
+ * Least squares time segmentation (Sutton et al.): exp(i om tau_t) ~
+ * sum_l bt(l,t) exp(i (om - mean) taul_l), fitted over the histogram
+ * of om. bt carries exp(i mean tau_t). Returns the mean.
+ */
+double NUFFTOperator::Segment (const std::vector<double>& om, const std::vector<double>& tau,
+		const unsigned segments, std::vector<cplx>& bt, std::vector<double>& taul) {
+
+	const double omin = *std::min_element (om.begin(), om.end()),
+			     omax = *std::max_element (om.begin(), om.end()),
+			     tmin = *std::min_element (tau.begin(), tau.end()),
+			     tmax = *std::max_element (tau.begin(), tau.end()),
+			     mean = .5*(omax+omin), span = .5*(omax-omin) * (tmax-tmin);
+
+	_nl = (segments) ? segments : (unsigned) ceil (span/1.5) + 3; // Errors about 1e-4
+	if (span < 1.0e-6)
+		_nl = 1;
+	_nl = std::min (_nl, MAXSEG);
+
+	taul.resize (_nl);
+	bt.resize (_nl*_nk);
+	for (unsigned l = 0; l < _nl; ++l)
+		taul[l] = (_nl > 1) ? tmin + (tmax-tmin) * l / (_nl-1) : .5*(tmin+tmax);
+
+	std::vector<double> wb (NBINS, 0.), db (NBINS);        // Histogram
+	for (unsigned b = 0; b < NBINS; ++b)
+		db[b] = (omin - mean) + (omax - omin) * (b + .5) / NBINS;
+	for (size_t i = 0; i < om.size(); ++i)
+		wb[(omax > omin) ? std::min<unsigned> (NBINS-1, (unsigned)((om[i]-omin) / (omax-omin) * NBINS)) : 0] += 1.;
+
+	std::vector<dcplx> a (NBINS*_nl), l (_nl*_nl, 0.), y (_nl);
+	for (unsigned b = 0; b < NBINS; ++b)
+		for (unsigned j = 0; j < _nl; ++j)
+			a[b*_nl+j] = std::polar (1., db[b]*taul[j]);
+
+	double tr = 0.;                          // Gram, lower, ridged
+	for (unsigned i = 0; i < _nl; ++i)
+		for (unsigned j = 0; j <= i; ++j)
+			for (unsigned b = 0; b < NBINS; ++b)
+				l[i*_nl+j] += wb[b] * std::conj (a[b*_nl+i]) * a[b*_nl+j];
+	for (unsigned i = 0; i < _nl; ++i)
+		tr += l[i*_nl+i].real();
+	for (unsigned i = 0; i < _nl; ++i)
+		l[i*_nl+i] += 1.0e-8 * tr / _nl;
+
+	for (unsigned j = 0; j < _nl; ++j) {     // Cholesky
+		double dj = l[j*_nl+j].real();
+		for (unsigned k = 0; k < j; ++k)
+			dj -= std::norm (l[j*_nl+k]);
+		l[j*_nl+j] = sqrt (dj);
+		for (unsigned i = j+1; i < _nl; ++i) {
+			dcplx s = l[i*_nl+j];
+			for (unsigned k = 0; k < j; ++k)
+				s -= l[i*_nl+k] * std::conj (l[j*_nl+k]);
+			l[i*_nl+j] = s / l[j*_nl+j].real();
+		}
+	}
+
+	for (unsigned t = 0; t < _nk; ++t) {
+		for (unsigned i = 0; i < _nl; ++i) {
+			y[i] = 0.;
+			for (unsigned b = 0; b < NBINS; ++b)
+				y[i] += wb[b] * std::conj (a[b*_nl+i]) * std::polar (1., db[b]*tau[t]);
+		}
+		for (unsigned i = 0; i < _nl; ++i) { // L y = rhs
+			for (unsigned k = 0; k < i; ++k)
+				y[i] -= l[i*_nl+k] * y[k];
+			y[i] /= l[i*_nl+i].real();
+		}
+		for (int i = _nl-1; i >= 0; --i) {   // L^H b = y
+			for (unsigned k = i+1; k < _nl; ++k)
+				y[i] -= std::conj (l[k*_nl+i]) * y[k];
+			y[i] /= l[i*_nl+i].real();
+		}
+		const dcplx e = std::polar (1., fmod (mean*tau[t], 2.*M_PI));
+		for (unsigned i = 0; i < _nl; ++i)
+			bt[i*_nk+t] = cplx (y[i] * e);
+	}
+
+	return mean;
+
+}
+
+
+bool NUFFTOperator::Cartesian () const {
+	return _ok;
+}
+
+
+size_t NUFFTOperator::Rows () const {
+	return _nv;
+}
+
+
+size_t NUFFTOperator::Cols () const {
+	return _nx;
+}
+
+
+double NUFFTOperator::Frob () const {
+	return _frob;
+}
+
+
+unsigned NUFFTOperator::Segments () const {
+	return _nl;
+}
+
+
+const unsigned* NUFFTOperator::Grid () const {
+	return _k;
+}
+
+
+const double NUFFTOperator::SetupTime () const {
+	return _setupms;
+}
+
+
+const double NUFFTOperator::ApplyTime () const {
+	return _applyms;
+}
+
+
+const double NUFFTOperator::CG (const cplx* d, const float lambda, const float tol, cplx* x,
+		unsigned& it, float& res) const {
+
+	double start = WallTime();
+
+	codeare::solvers::CG (*this, d, lambda, tol, x, it, res);
+
+	return WallTime() - start;
+
+}
+
+
+void NUFFTOperator::Spread (cplx* grid, const unsigned t, const cplx val) const {
+
+	const int*   j0 = &_j0[3*t];
+	const float* w  = &_w[3*t*KW];
+	const int    m0 = _k[0]-1, m1 = _k[1]-1, m2 = _k[2]-1,
+			     w1 = (_k[1] > 1) ? KW : 1, w2 = (_k[2] > 1) ? KW : 1, w0 = (_k[0] > 1) ? KW : 1;
+
+	for (int a2 = 0; a2 < w2; ++a2) {
+		const cplx   v2 = val * w[2*KW+a2];
+		const size_t o2 = (size_t)((j0[2]+a2) & m2) * _k[1];
+		for (int a1 = 0; a1 < w1; ++a1) {
+			const cplx v1 = v2 * w[KW+a1];
+			cplx* row = grid + (o2 + ((j0[1]+a1) & m1)) * _k[0];
+			for (int a0 = 0; a0 < w0; ++a0)
+				row[(j0[0]+a0) & m0] += v1 * w[a0];
+		}
+	}
+
+}
+
+
+cplx NUFFTOperator::Interp (const cplx* grid, const unsigned t) const {
+
+	const int*   j0 = &_j0[3*t];
+	const float* w  = &_w[3*t*KW];
+	const int    m0 = _k[0]-1, m1 = _k[1]-1, m2 = _k[2]-1,
+			     w1 = (_k[1] > 1) ? KW : 1, w2 = (_k[2] > 1) ? KW : 1, w0 = (_k[0] > 1) ? KW : 1;
+	cplx ret = 0.f;
+
+	for (int a2 = 0; a2 < w2; ++a2) {
+		const size_t o2 = (size_t)((j0[2]+a2) & m2) * _k[1];
+		cplx acc2 = 0.f;
+		for (int a1 = 0; a1 < w1; ++a1) {
+			const cplx* row = grid + (o2 + ((j0[1]+a1) & m1)) * _k[0];
+			cplx acc1 = 0.f;
+			for (int a0 = 0; a0 < w0; ++a0)
+				acc1 += row[(j0[0]+a0) & m0] * w[a0];
+			acc2 += acc1 * w[KW+a1];
+		}
+		ret += acc2 * w[2*KW+a2];
+	}
+
+	return ret;
+
+}
+
+
+/*
+ * In-place radix-2 FFT along every dimension, unnormalised:
+ * exp(-i...) forward, exp(+i...) inverse
+ */
+void NUFFTOperator::FFT (cplx* grid, const bool inverse) const {
+
+	size_t stride = 1;
+
+	for (unsigned d = 0; d < 3; ++d) {
+
+		const unsigned k = _k[d];
+		if (k == 1)
+			continue;
+
+		std::vector<cplx> line (k);
+		const std::vector<cplx>&     tw  = _tw[d];
+		const std::vector<unsigned>& rev = _rev[d];
+
+		for (size_t o = 0; o < _ng / (k*stride); ++o)
+			for (size_t i = 0; i < stride; ++i) {
+
+				cplx* base = grid + o*k*stride + i;
+				for (unsigned j = 0; j < k; ++j)
+					line[rev[j]] = base[j*stride];
+
+				for (unsigned len = 2; len <= k; len *= 2) {
+					const unsigned half = len/2, step = k/len;
+					for (unsigned s = 0; s < k; s += len)
+						for (unsigned j = 0; j < half; ++j) {
+							const cplx w = (inverse) ? std::conj (tw[j*step]) : tw[j*step];
+							const cplx u = line[s+j], v = line[s+j+half] * w;
+							line[s+j]      = u + v;
+							line[s+j+half] = u - v;
+						}
+				}
+
+				for (unsigned j = 0; j < k; ++j)
+					base[j*stride] = line[j];
+
+			}
+
+		stride *= k;
+
+	}
+
+}
+
+
+/**
+ * @brief One grid per segment and channel: spread, FFT and sample the
+ *        voxels (E), or the reverse (E^H). Threads accumulate privately.
+ */
+void NUFFTOperator::Apply (const bool adjoint, const cplx* x, cplx* y) const {
+
+	double start = WallTime();
+
+	const size_t ny = (adjoint) ? _nx : _nv;
+	std::fill (y, y+ny, cplx(0.f));
+
+#pragma omp parallel
+	{
+		std::vector<cplx> grid (_ng), ly (ny, cplx(0.f));
+
+#pragma omp for schedule(dynamic)
+		for (long lc = 0; lc < (long)(_nl*_nc); ++lc) {
+
+			const unsigned l = lc % _nl, c = lc / _nl;
+			const cplx* st = &_st[l*_nk];
+			const cplx* sv = &_sv[l*_nv];
+			const cplx* b1 = &_b1[c*_nv];
+
+			std::fill (grid.begin(), grid.end(), cplx(0.f));
+
+			if (adjoint) {
+				for (size_t i = 0; i < _nv; ++i)
+					grid[_gv[i]] += std::conj (sv[i] * b1[i]) * x[i]; // Voxels may coincide
+				FFT (&grid[0], true);
+				for (unsigned t = 0; t < _nk; ++t)
+					ly[t+c*_nk] += std::conj (st[t]) * Interp (&grid[0], t);
+			} else {
+				for (unsigned t = 0; t < _nk; ++t)
+					Spread (&grid[0], t, st[t] * x[t+c*_nk]);
+				FFT (&grid[0], false);
+				for (size_t i = 0; i < _nv; ++i)
+					ly[i] += sv[i] * b1[i] * grid[_gv[i]];
+			}
+
+		}
+
+#pragma omp critical
+		for (size_t i = 0; i < ny; ++i)
+			y[i] += ly[i];
+	}
+
+	_applyms = WallTime() - start;
+
+}
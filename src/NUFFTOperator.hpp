@@ -0,0 +1,96 @@
+#ifndef __NUFFT_OPERATOR_HPP__
+#define __NUFFT_OPERATOR_HPP__
+
+#include <complex>
+#include <vector>
+#include <cstddef>
+
+/**
+ * @brief Small tip angle operators E and E^H (the model of stafwd and staadj)
+ *        by non-uniform FFT: Kaiser-Bessel gridding of the excitation k-space
+ *        onto an oversampled Cartesian grid of the voxels, with b0 by least
+ *        squares time segmentation
+ */
+namespace codeare {
+    namespace nufft {
+
+        class NUFFTOperator {
+
+            typedef std::complex<float> cplx;
+
+        public:
+
+            /**
+             * @brief Set up grid, kernel and segment interpolators
+             *
+             * @param vox       Modelled voxels, must lie on a Cartesian lattice
+             * @param segments  Time segments for b0 (0: from the off-resonance range)
+             */
+            NUFFTOperator (const float* b1, const float* g, const float* r, const float* b0,
+            		const float* gs, const float* m0, const std::vector<unsigned>& vox,
+            		const unsigned nr, const unsigned nc, const unsigned nk, const float dt,
+            		const unsigned segments = 0);
+
+            /**
+             * @brief Voxels lie on a Cartesian lattice (else the operator is unusable)
+             */
+            bool Cartesian () const;
+
+            /**
+             * @brief y = E x or y = E^H x
+             */
+            void Apply (const bool adjoint, const cplx* x, cplx* y) const;
+
+            /**
+             * @brief min |E x - d|^2 + lambda |x|^2 by CG (see SystemMatrix::CG)
+             *
+             * @return         Time in ms
+             */
+            const double CG (const cplx* d, const float lambda, const float tol, cplx* x,
+            		unsigned& it, float& res) const;
+
+            size_t Rows () const;
+            size_t Cols () const;
+            double Frob () const;
+
+            unsigned Segments () const;
+            const unsigned* Grid () const;       /**!< Oversampled grid size per dimension */
+            const double SetupTime () const;
+            const double ApplyTime () const;     /**!< Of the last Apply */
+
+        private:
+
+            void Spread (cplx* grid, const unsigned t, const cplx val) const;
+            cplx Interp (const cplx* grid, const unsigned t) const;
+            void FFT    (cplx* grid, const bool inverse) const;
+
+            double Segment (const std::vector<double>& om, const std::vector<double>& tau,
+            		const unsigned segments, std::vector<cplx>& bt, std::vector<double>& taul);
+
+            size_t   _nv;            /**!< Rows: modelled voxels */
+            size_t   _nx;            /**!< Columns: nc*nk */
+            unsigned _nc, _nk, _nl;  /**!< Channels, time points, segments */
+            bool     _ok;            /**!< Voxels on a lattice */
+            double   _frob;          /**!< |E|_F^2 */
+            double   _setupms;       /**!< Time to set up */
+            mutable double _applyms; /**!< Time of the last Apply */
+
+            unsigned _k[3];          /**!< Oversampled grid (1 for flat dimensions) */
+            size_t   _ng;            /**!< Grid points */
+
+            std::vector<int>    _j0; /**!< First grid index of the kernel per t and dimension */
+            std::vector<float>  _w;  /**!< Kernel weights per t, dimension and tap */
+            std::vector<cplx>   _st; /**!< Time side per segment and t: interpolator, offsets */
+            std::vector<size_t> _gv; /**!< Grid index per voxel */
+            std::vector<cplx>   _sv; /**!< Voxel side per segment: m0, deapodisation, b0 */
+            std::vector<cplx>   _b1; /**!< Sensitivities per channel and voxel */
+
+            std::vector<cplx>     _tw[3];  /**!< FFT twiddles */
+            std::vector<unsigned> _rev[3]; /**!< FFT bit reversal */
+
+        };
+
+    }
+}
+
+#endif //__NUFFT_OPERATOR_HPP__
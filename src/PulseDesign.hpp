@@ -2,8 +2,25 @@
 #define __MR_SIM_DATA__
 
 #include "CLProcessor.hpp"
+#include "CoilCompression.hpp"
+#include "DesignConfig.hpp"
 #include "HDF5File.hpp"
+#include "MPIProcessor.hpp"
+#include "NUFFTOperator.hpp"
+#include "SHMProcessor.hpp"
 #include "SimpleTimer.hpp"
+#include "SystemMatrix.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+// Largest deviation of a cross-check (-x), relative to the reference's maximum
+#define CHECK_TOL 1.0e-4
+
+// --scan-auto: parallel-in-time kernels below this many voxels per compute unit.
+// An unmeasured estimate of device occupancy, hence opt-in rather than the default.
+#define SCAN_VOXELS_PER_CU 32
 
 /**
  * @brief  Pulse design according to
@@ -15,17 +32,33 @@ class PulseDesign {
     typedef std::complex<T> cplx;
     typedef T               real;
 
-    unsigned nr, nc, nk;
+    unsigned nr, nc, nk, np;
+    float    _dt;
+    unsigned _v0, _nvox; // Voxels [_v0, _v0+nr) of _nvox (MPI)
+    std::vector<unsigned> _active; // Positions of compacted or reordered voxels in the loaded ones
+    NDData<real> _icf;             // ic of all loaded voxels, while compacted or reordered
 
-    bool _verbose;
+    DesignConfig _conf;
+    std::string  _bopts; // Kernel build options
 
     NDData<cplx> b1, rf;
+    NDData<cplx> vc;                                   // Virtual channels (-y), physical x nc
     NDData<real>  r, b0, m0, gs, g, j, m, ic, tm0;     // MR data
+    NDData<real>  pr, pm0, pgs, pm, ptm0;              // Planar device copies (--planar)
 
     cl::Buffer rfbuf, b1buf, rbuf, m0buf, mbuf, b0buf, pbuf,
-    	xbuf, gsbuf, gbuf, brfbuf, jbuf, icbuf, tm0buf;  // OpenCL representations
+    	xbuf, gsbuf, gbuf, brfbuf, jbuf, icbuf, tm0buf,  // OpenCL representations
+    	rftbuf;                                          // Time-major RF (--rf-time)
+    cl::Buffer resbuf, wbuf, zbuf, dirbuf, sbuf, nbuf; // CGNR vectors, scalars and norm partials
+
+    std::vector<cl::Event>   _uploads; // Pending uploads of the input
+    std::vector<cl::Event>   _events;  // Enqueued kernels (--async)
+    std::vector<std::string> _enames;  // and their names
+    double                   _redms;   // Time of the last signal reduction in ms
 
+    std::string _in_file;  // Input file
     std::string _out_file; // Output file
+    bool        _failed;   // A cross-check deviated beyond CHECK_TOL or a -l solve did not converge
 
 public:
 
@@ -33,7 +66,7 @@ public:
     /**
      * @brief Default constructor
      */
-    PulseDesign () : nr(0), nc(1), nk(0), _verbose(false) {}
+    PulseDesign () : nr(0), nc(1), nk(0), np(0), _dt(1.0e-2), _v0(0), _nvox(0), _redms(0.), _failed(false) {}
 
 
     /**
@@ -41,10 +74,12 @@ public:
      *
      * @param  in_file   Incoming (b0, b1, r, m0, gs, g, j)
      * @param  out_file  Outgoing (rf, ic, m)
+     * @param  conf      Algorithmic choices
      */
     PulseDesign (const std::string& in_file,
-    		const std::string& out_file = "out.h5", const bool verbose = false) :
-    			_out_file (out_file), _verbose(verbose) {
+    		const std::string& out_file = "out.h5", const DesignConfig& conf = DesignConfig()) :
+    			np(0), _dt(1.0e-2), _v0(0), _conf(conf), _bopts(conf.BuildOptions()),
+    			_redms(0.), _in_file (in_file), _out_file (out_file), _failed(false) {
 
     	// Read data
         HDF5File f;
@@ -63,116 +98,1717 @@ public:
         nr  = size(r,  1);
         nc  = size(b1, 1);
         nk  = size(g,  1);
+        _nvox = nr;
+        Compact  ();
+        Compress ();
 
         // Intermediate and outgoing.
         rf  = NDData<cplx> (nk,nc);    // rf RF pulses nk x nc
-        m   = NDData<real> (size(m0)); // Excited magnetisation
-        ic  = NDData<real> (nr);       // Intensity correction
+        if (nr) {                      // Else all empty, see Compact
+        	m   = NDData<real> (3,nr); // Excited magnetisation
+        	ic  = NDData<real> (nr);   // Intensity correction
+        }
+
+        _bopts += ShapeOptions();
+    }
+
+    /**
+     * @brief Construct with this rank's slab of voxels read from in_file.
+     *        Only rank 0 writes output.
+     *
+     * @param  in_file   Incoming (b0, b1, r, m0, gs, g, j)
+     * @param  out_file  Outgoing (rf, ic, m)
+     * @param  conf      Algorithmic choices
+     * @param  mp        MPI ranks
+     */
+    PulseDesign (const std::string& in_file, const std::string& out_file,
+    		const DesignConfig& conf, const codeare::mpi::MPIProcessor& mp) :
+    			np(0), _dt(1.0e-2), _conf(conf), _bopts(conf.BuildOptions()),
+    			_redms(0.), _in_file (in_file), _out_file ((mp.Rank()) ? "" : out_file), _failed(false) {
+
+        HDF5File f;
+        f   = fopen (in_file);
+        _nvox = f.Dims<real>("r")[1];
+        nc  = f.Dims<cplx>("b1")[1];
+        g   = fread<real>(f,  "g");
+        j   = fread<real>(f,  "j");
+        nk  = size(g,  1);
+        mp.Partition (_nvox, _v0, nr);
+        if (nr) {                    // Flat slabs as in Voxels
+        	f.Read (b1,  "b1", "/",   _v0,   nr, nc, _nvox);
+        	f.Read (r,    "r", "/", 3*_v0, 3*nr);
+        	f.Read (m0,  "m0", "/", 3*_v0, 3*nr);
+        	f.Read (b0,  "b0", "/",   _v0,   nr);
+        	f.Read (gs,  "gs", "/", 3*_v0, 3*nr);
+        	f.Read (tm0,"tm0", "/", 3*_v0, 3*nr);
+        	Compact ();
+        }
+        if (nr) {                    // Ranks without active voxels skip the design
+            m   = NDData<real> (3,nr);
+            ic  = NDData<real> (nr);
+        }
+        fclose (f);
+        Compress (&mp);
+
+        rf  = NDData<cplx> (nk,nc);
+
+        _bopts += ShapeOptions();
+    }
+
+    /**
+     * @brief Voxels [v0, v0+nv) of a design, for one device of a partitioned
+     *        run. Writes no output.
+     *
+     * @param  pd  Complete design
+     * @param  v0  First voxel
+     * @param  nv  Number of voxels
+     */
+    PulseDesign (const PulseDesign& pd, const unsigned v0, const unsigned nv) :
+    		nr(nv), nc(pd.nc), nk(pd.nk), np(0), _dt(pd._dt), _v0(pd._v0+v0), _nvox(pd._nvox),
+    		_conf(pd._conf), _bopts(pd._bopts), _redms(0.), _failed(false) {
+
+        b1  = pd.Voxels (pd.b1,  v0, nv, 1, nc);
+        r   = pd.Voxels (pd.r,   v0, nv, 3);
+        m0  = pd.Voxels (pd.m0,  v0, nv, 3);
+        b0  = pd.Voxels (pd.b0,  v0, nv, 1);
+        gs  = pd.Voxels (pd.gs,  v0, nv, 3);
+        tm0 = pd.Voxels (pd.tm0, v0, nv, 3);
+        g   = pd.g;
+        j   = pd.j;
+
+        rf  = NDData<cplx> (nk,nc);
+        m   = NDData<real> (3,nr);
+        ic  = NDData<real> (nr);
+
+        _conf.check = false;         // Checked once over all voxels
     }
 
     /**
      * @brief Write output
      */
     ~PulseDesign () {
+    	if (_out_file.empty())
+    		return;
+    	Scatter ();
     	HDF5File f (_out_file, OUT);
-		fwrite (f, rf);
-		fwrite (f, m);
-		fwrite (f, ic);
-		fclose (f);
+    	if (vc.Size()) {                      // Physical channels
+    		NDData<cplx> prf (nk, size(vc,0));
+    		codeare::shm::CoilCompression::Expand ((const std::complex<float>*) vc.Ptr(),
+    				size(vc,0), nc, (const std::complex<float>*) rf.Ptr(), nk,
+    				(std::complex<float>*) prf.Ptr());
+    		f.Write (prf, "rf");
+    	} else {
+    		fwrite (f, rf);
+    	}
+    	fwrite (f, m);
+    	fwrite (f, ic);
+    	fclose (f);
     }
     
+    /**
+     * @brief  Drop voxels without target and initial magnetisation (m0 and
+     *         tm0 zero): neither kernel has work for them. Voxel data shrinks
+     *         to the active ones, so that only those are launched; m and ic
+     *         are scattered back on output (see Scatter). With -O they are
+     *         also sorted along a space-filling curve.
+     */
+    void Compact () {
+
+    	if ((!_conf.compact && _conf.order == LOADED) || !nr)
+    		return;
+
+    	std::vector<unsigned> act;
+    	for (unsigned v = 0; v < nr; ++v)
+    		for (unsigned k = 0; k < 3; ++k)
+    			if (!_conf.compact || m0[3*v+k] != 0.f || tm0[3*v+k] != 0.f) {
+    				act.push_back (v);
+    				break;
+    			}
+    	if (_conf.order != LOADED)
+    		Order (act);
+    	else if (act.size() == nr)
+    		return;
+
+    	_icf = NDData<real> (nr);                // Intensity correction of all
+    	codeare::shm::SHMProcessor().IntCor ((const float*) b1.Ptr(), nc, nr, _icf.Ptr());
+    	_active = act;
+
+    	if (act.empty()) {                       // Nothing to design: zero rf and m
+    		if (_conf.verbose)
+    			printf ("    Compact    ... 0 of %u voxels active.\n", nr);
+    		nr = 0;
+    		return;
+    	}
+
+    	b1  = Pick (b1,  act, 1, nc);
+    	r   = Pick (r,   act, 3);
+    	m0  = Pick (m0,  act, 3);
+    	b0  = Pick (b0,  act, 1);
+    	gs  = Pick (gs,  act, 3);
+    	tm0 = Pick (tm0, act, 3);
+
+    	if (_conf.verbose && _conf.compact)
+    		printf ("    Compact    ... %zu of %u voxels active.\n", act.size(), nr);
+    	if (_conf.verbose && _conf.order != LOADED)
+    		printf ("    Order      ... %s curve.\n", (_conf.order == MORTON) ? "Morton" : "Hilbert");
+    	nr = act.size();
+
+    }
+
+    /**
+     * @brief  Sort voxels vox along a Morton or Hilbert curve through their
+     *         positions, quantised to 10 bits per non-flat dimension
+     */
+    void Order (std::vector<unsigned>& vox) const {
+
+    	if (vox.size() < 2)
+    		return;
+
+    	float lo[3], hi[3];
+    	for (unsigned k = 0; k < 3; ++k) {
+    		lo[k] = hi[k] = r[3*vox[0]+k];
+    		for (size_t i = 1; i < vox.size(); ++i) {
+    			lo[k] = std::min (lo[k], r[3*vox[i]+k]);
+    			hi[k] = std::max (hi[k], r[3*vox[i]+k]);
+    		}
+    	}
+
+    	std::vector<std::pair<unsigned,unsigned> > key (vox.size());
+    	for (size_t i = 0; i < vox.size(); ++i) {
+    		unsigned x[3], n = 0;
+    		for (unsigned k = 0; k < 3; ++k)
+    			if (hi[k] > lo[k])
+    				x[n++] = (unsigned) (1023.f * (r[3*vox[i]+k] - lo[k]) / (hi[k] - lo[k]) + .5f);
+    		if (_conf.order == HILBERT)
+    			HilbertTranspose (x, n, 10);
+    		key[i] = std::make_pair (Interleave (x, n, 10), vox[i]);
+    	}
+    	std::stable_sort (key.begin(), key.end());
+
+    	for (size_t i = 0; i < vox.size(); ++i)
+    		vox[i] = key[i].second;
+
+    }
+
+    /**
+     * @brief  Bits of x (n coordinates of b bits), most significant first
+     */
+    inline static unsigned
+    Interleave (const unsigned* x, const unsigned n, const unsigned b) {
+    	unsigned key = 0;
+    	for (int bit = b-1; bit >= 0; --bit)
+    		for (unsigned k = 0; k < n; ++k)
+    			key = (key << 1) | ((x[k] >> bit) & 1);
+    	return key;
+    }
+
+    /**
+     * @brief  Coordinates to the transposed Hilbert index (J. Skilling,
+     *         AIP Conf. Proc. 707, 381, 2004), interleaved by Interleave
+     */
+    inline static void
+    HilbertTranspose (unsigned* x, const unsigned n, const unsigned b) {
+    	for (unsigned q = 1 << (b-1); q > 1; q >>= 1) {    // Inverse undo
+    		const unsigned p = q - 1;
+    		for (unsigned k = 0; k < n; ++k)
+    			if (x[k] & q)
+    				x[0] ^= p;
+    			else {
+    				const unsigned t = (x[0] ^ x[k]) & p;
+    				x[0] ^= t;
+    				x[k] ^= t;
+    			}
+    	}
+    	for (unsigned k = 1; k < n; ++k)                    // Gray encode
+    		x[k] ^= x[k-1];
+    	unsigned t = 0;
+    	for (unsigned q = 1 << (b-1); q > 1; q >>= 1)
+    		if (n && (x[n-1] & q))
+    			t ^= q - 1;
+    	for (unsigned k = 0; k < n; ++k)
+    		x[k] ^= t;
+    }
+
+    /**
+     * @brief  m and ic of the compacted or reordered voxels back to all loaded ones
+     *         (m zero, ic from Compact elsewhere). Once, after the design.
+     */
+    void Scatter () {
+
+    	if (!_icf.Size())                        // Not compacted, or scattered
+    		return;
+
+    	const unsigned nf = _icf.Size();
+    	NDData<real> mf (3,nf);
+    	for (size_t i = 0; i < _active.size(); ++i) {
+    		for (unsigned k = 0; k < 3; ++k)
+    			mf[3*_active[i]+k] = m[3*i+k];
+    		_icf[_active[i]] = ic[i];
+    	}
+    	m  = mf;
+    	ic = _icf;
+    	nr = nf;
+    	_active.clear();
+    	_icf = NDData<real> ();
+
+    }
+
+    /**
+     * @brief  Replace b1 by its principal virtual channels (-y), from the
+     *         Gram matrix over all voxels (of all ranks). The design runs
+     *         on those, rf is expanded to the physical channels on output.
+     *
+     * @param  mp  MPI ranks, if any
+     */
+    void Compress (const codeare::mpi::MPIProcessor* mp = 0) {
+
+    	typedef std::complex<float> fcplx;
+
+    	if (_conf.compress <= 0.f)
+    		return;
+
+    	codeare::shm::CoilCompression cc ((const fcplx*) b1.Ptr(), nr, nc);
+    	if (mp)
+    		mp->AllReduce (cc.Gram(), 2*nc*nc);
+    	const unsigned nv = cc.Decompose (_conf.compress);
+
+    	NDData<cplx> vb1 (std::max (nr, 1u), nv);
+    	if (nr)
+    		cc.Compress ((const fcplx*) b1.Ptr(), nr, (fcplx*) vb1.Ptr());
+    	vc = NDData<cplx> (nc, nv);
+    	std::copy (cc.Vectors(), cc.Vectors() + nc*nv, (fcplx*) vc.Ptr());
+    	if (!mp || !mp->Rank())
+    		printf ("    Compress   ... %u -> %u channels, %.2f%% of |b1|^2; wtime: %.3fs.\n",
+    				nc, nv, 100.*cc.Energy(), 1.0e-3*cc.Time());
+
+    	if (nr)
+    		b1 = vb1;
+    	nc = nv;
+
+    }
+
     /**
      * @brief  Upload to GPU run design algorithm and download data
      *
      * @param cp  Assigned processor class
      */
     inline void DesignOn (codeare::opencl::CLProcessor& cp) {
+    	if (!nr)
+    		return Idle ();
+    	if (cp.NDevices() > 1)
+    		return DesignOnDevices (cp);
     	GPUUpload (cp);
     	CGNR (cp);
+    	if (_conf.check)
+    		CrossCheck (cp);
     	GPUDownload (cp);
+    	if (_conf.async)
+            printf ("    Running    program ... done; wtime: %.3fs.\n", 1.0e-3*Elapsed());
+    }
+
+    /**
+     * @brief  Run the design on the host with the native engine
+     *
+     * @param sp  Native processor
+     */
+    inline void DesignOn (const codeare::shm::SHMProcessor& sp) {
+    	if (!nr)
+    		return Idle ();
+    	double wtime = HostDesign ();
+    	const bool host = (wtime >= 0.);
+    	wtime = (host) ?
+    			wtime + sp.IntCor ((const float*) b1.Ptr(), nc, nr, ic.Ptr()) +
+    			NativeExcite (sp, rf, m) : Native (sp, rf, m, ic);
+        printf ("    Running    native  ... done (%d threads, %u lanes); wtime: %.3fs.\n",
+        		sp.Threads(), sp.Lanes(), 1.0e-3*wtime);
+    	if (_conf.check && !host)
+    		NativeCheck (sp);
+    }
+
+    /**
+     * @brief  Run this rank's voxels on a device, sum the RF over all ranks
+     *         and gather m and ic on rank 0
+     *
+     * @param mp  MPI ranks
+     * @param cp  This rank's device
+     */
+    inline void DesignOn (const codeare::mpi::MPIProcessor& mp, codeare::opencl::CLProcessor& cp) {
+    	double wtime = 0.;
+    	if (nr) {
+    		GPUUpload (cp);
+    		wtime += Correct (cp);
+    		wtime += Signal  (cp);
+    		cp.Copy (rfbuf, rf, &_events);
+    		wtime += Elapsed ();
+    	}
+    	wtime += mp.AllReduce ((float*) rf.Ptr(), 2*rf.Size());
+    	if (nr) {
+    		cp.Copy (rf, rfbuf);
+    		wtime += Excite (cp, rfbuf, mbuf);
+    		CopyM   (cp, mbuf,  m,  &_events);
+    		cp.Copy (icbuf, ic, &_events);
+    		wtime += Elapsed ();
+    	}
+    	Assemble (mp, wtime);
+    }
+
+    /**
+     * @brief  Run this rank's voxels with the native engine, sum the RF over
+     *         all ranks and gather m and ic on rank 0
+     *
+     * @param mp  MPI ranks
+     * @param sp  Native processor
+     */
+    inline void DesignOn (const codeare::mpi::MPIProcessor& mp, const codeare::shm::SHMProcessor& sp) {
+    	double wtime = 0.;
+    	if (nr)
+    		wtime += NativeSignal (sp, rf, ic);
+    	wtime += mp.AllReduce ((float*) rf.Ptr(), 2*rf.Size());
+    	if (nr)
+    		wtime += NativeExcite (sp, rf, m);
+    	Assemble (mp, wtime);
+    }
+
+    /**
+     * @brief A cross-check (-x) deviated by more than CHECK_TOL of the
+     *        reference's maximum, or a least squares design (-l -x) ended
+     *        at or above its tolerance
+     */
+    inline bool Failed () const {
+    	return _failed;
     }
 
 protected:
 
+    /**
+     * @brief No active voxel (see Compact): rf and m stay zero
+     */
+    inline void Idle () const {
+        printf ("    Running    ... no active voxels; rf and m are zero.\n");
+    }
+
+    /**
+     * @brief intcor, simacq, redsig and simexc with the native engine
+     *
+     * @param  sp   Native processor
+     * @param  rfo  RF pulses
+     * @param  mo   Excited magnetisation
+     * @param  ico  Intensity correction
+     * @param  ref  Two-pass reference acquisition (see NativeSignal)
+     * @return      Time in ms
+     */
+    double Native (const codeare::shm::SHMProcessor& sp, NDData<cplx>& rfo, NDData<real>& mo,
+    		NDData<real>& ico, const bool ref = false) const {
+    	return NativeSignal (sp, rfo, ico, ref) + NativeExcite (sp, rfo, mo);
+    }
+
+    /**
+     * @brief intcor and simacqred with the native engine, or as reference
+     *        (-x) simacq to nc*nk*nr per-voxel signals and redsig
+     *
+     * @return      Time in ms
+     */
+    double NativeSignal (const codeare::shm::SHMProcessor& sp,
+    		NDData<cplx>& rfo, NDData<real>& ico, const bool ref = false) const {
+
+    	NDData<real> lgs = Voxels (gs, 0, nr, 3); // r3.h5 has short gs
+    	const float *fb1 = (const float*) b1.Ptr(), *fg = g.Ptr(), *fr = r.Ptr(), *fb0 = b0.Ptr();
+    	double wtime = 0., ms;
+
+    	wtime += (ms = sp.IntCor (fb1, nc, nr, ico.Ptr()));
+    	if (_conf.verbose)
+    		printf ("    Native   intcor (%03.1f ms).\n", ms);
+    	if (!ref) {
+    		wtime += (ms = sp.SimAcqRed (fb1, fg, fr, fb0, lgs.Ptr(), m0.Ptr(), ico.Ptr(), j.Ptr(),
+    				nr, nc, nk, _dt, (float*) rfo.Ptr()));
+    		if (_conf.verbose)
+    			printf ("    Native   simacqred (%03.1f ms).\n", ms);
+    		return wtime;
+    	}
+
+    	NDData<cplx> brf (nk,nc,nr);             // Signals (zero)
+    	wtime += (ms = sp.SimAcq (fb1, fg, fr, fb0, lgs.Ptr(), m0.Ptr(), ico.Ptr(), nr, nc, nk, _dt,
+    			(float*) brf.Ptr()));
+    	if (_conf.verbose)
+    		printf ("    Native   simacq (%03.1f ms).\n", ms);
+    	wtime += (ms = sp.RedSig ((const float*) brf.Ptr(), j.Ptr(), nc, nk, nr, (float*) rfo.Ptr()));
+    	if (_conf.verbose)
+    		printf ("    Native   redsig (%03.1f ms).\n", ms);
+
+    	return wtime;
+
+    }
+
+    /**
+     * @brief -x on the native engine: the two-pass acquisition as reference
+     */
+    void NativeCheck (const codeare::shm::SHMProcessor& sp) {
+    	NDData<cplx> rfref (nk,nc);
+    	NDData<real> mref (3,nr), icref (nr);
+    	const double wtime = Native (sp, rfref, mref, icref, true);
+    	Compare ("2-pass", wtime, rfref, mref);
+    }
+
+    /**
+     * @brief simexc with the native engine
+     *
+     * @return      Time in ms
+     */
+    double NativeExcite (const codeare::shm::SHMProcessor& sp,
+    		const NDData<cplx>& rfi, NDData<real>& mo) const {
+
+    	NDData<real> lgs = Voxels (gs, 0, nr, 3);
+    	const float *fb1 = (const float*) b1.Ptr(), *fg = g.Ptr(), *fr = r.Ptr(), *fb0 = b0.Ptr();
+    	double wtime = 0., ms;
+
+    	wtime += (ms = sp.SimExc (fb1, fg, (const float*) rfi.Ptr(), fr, fb0, lgs.Ptr(), tm0.Ptr(),
+    			nr, nc, nk, _dt, mo.Ptr()));
+    	if (_conf.verbose)
+    		printf ("    Native   simexc (%03.1f ms).\n", ms);
+
+    	return wtime;
+
+    }
+
     /**
      * @brief Upload data to GPU
      *
      * @param  cp Assigned processor class
      */
     inline void GPUUpload (codeare::opencl::CLProcessor& cp) {
-    	cp.Copy (b1, b1buf);
-    	cp.Copy ( r,  rbuf);
-    	cp.Copy (m0, m0buf);
-    	cp.Copy (b0, b0buf);
-    	cp.Copy (gs, gsbuf);
-    	cp.Copy ( g,  gbuf);
-    	cp.Copy ( j,  jbuf);
-    	cp.Copy (tm0, tm0buf);
-    	mbuf  = cl::Buffer (cp.Context(), CL_MEM_READ_WRITE,
-    			sizeof(real) * 3*nr);               // Excitation profile
-    	rfbuf = cl::Buffer (cp.Context(), CL_MEM_READ_WRITE,
-    			sizeof(cplx) * nc*nk); 			 // RF scratch buffer
-    	brfbuf = cl::Buffer (cp.Context(), CL_MEM_READ_WRITE,
-    			sizeof(cplx) * nc*nk*nr);  // RF buffer
-    	icbuf = cl::Buffer (cp.Context(), CL_MEM_READ_WRITE,
-    			sizeof(real) * nr);              // Intesity correction
+    	Vectorise (cp);
+    	_uploads.clear();                        // Concurrent, through pinned memory
+    	Upload (cp, b1, b1buf);                  // or in place on host-unified devices
+    	Upload (cp, Layout ( r,  pr),  rbuf);
+    	Upload (cp, Layout (m0, pm0), m0buf);
+    	Upload (cp, b0, b0buf);
+    	Upload (cp, Layout (gs, pgs), gsbuf);
+    	Upload (cp,  g,  gbuf);
+    	Upload (cp,  j,  jbuf);
+    	Upload (cp, Layout (tm0, ptm0), tm0buf);
+    	mbuf  = cp.Buffer (Layout (m, pm));      // Excitation profile
+    	rfbuf = cp.Buffer (rf);                  // RF scratch buffer
+    	if (_conf.rftime)
+    		rftbuf = cl::Buffer (cp.Context(), CL_MEM_READ_WRITE, sizeof(cplx) * nc*nk);
+    	if (_conf.fused || _conf.tree) {
+    		np = 4 * cp.Device().getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+    		pbuf = cl::Buffer (cp.Context(), CL_MEM_READ_WRITE,
+    				sizeof(cplx) * nc*nk*np);   // Work-group partial RF
+    	}
+    	if (!_conf.fused || _conf.check)         // --fused: -x reference only
+    		brfbuf = cl::Buffer (cp.Context(), CL_MEM_READ_WRITE,
+    				sizeof(cplx) * nc*nk*nr);  // RF buffer
+    	icbuf = cp.Buffer (ic);                  // Intesity correction
+    	if (_conf.verbose && _bopts.find ("-DGCONST") != std::string::npos)
+    		printf ("    Constant   g and j ... %.1f kB; up to %.1f MB fewer global reads per simacq or simexc.\n",
+    				1.0e-3 * sizeof(real) * 4*nk, 1.0e-6 * sizeof(real) * 3*nk*nr);
+    	if (_conf.scanauto && !_conf.scan) {     // Too few voxels to fill the device?
+    		const unsigned cus = cp.Device().getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+    		_conf.scan = nr < SCAN_VOXELS_PER_CU * cus;
+    		if (_conf.verbose)
+    			printf ("    Scan       ... %u voxels on %u compute units: %s kernels.\n",
+    					nr, cus, (_conf.scan) ? "parallel-in-time" : "voxel-parallel");
+    	}
+    	if (!_conf.async)                        // Else the first kernel waits
+    		cp.Sync ();
+    }
+
+    /**
+     * @brief Voxel vectors (3 x nr) as the kernels take them: data itself,
+     *         or with --planar its transpose in planar
+     */
+    inline NDData<real>& Layout (NDData<real>& data, NDData<real>& planar) const {
+    	if (!_conf.planar)
+    		return data;
+    	planar = Transpose (Voxels (data, 0, nr, 3), 3, nr);
+    	return planar;
+    }
+
+    /**
+     * @brief  Planar voxel vectors back to data's interleaved layout
+     */
+    inline void Interleave (const NDData<real>& planar, NDData<real>& data) const {
+    	NDData<real> il = Transpose (planar, nr, 3);
+    	std::copy (il.Ptr(), il.Ptr() + 3*nr, data.Ptr());
+    }
+
+    /**
+     * @brief Download m from buf and restore the file layout of --planar
+     */
+    inline void CopyM (codeare::opencl::CLProcessor& cp, const cl::Buffer& buf, NDData<real>& mo,
+    		const std::vector<cl::Event>* wait = NULL) {
+    	if (!_conf.planar) {
+    		cp.Copy (buf, mo, wait);
+    		return;
+    	}
+    	NDData<real> pl (3*nr);
+    	cp.Copy (buf, pl, wait);
+    	Interleave (pl, mo);
+    }
+
+    /**
+     * @brief Start uploading data to buf; the first kernel waits for it
+     */
+    template<class S> inline void
+    Upload (codeare::opencl::CLProcessor& cp, NDData<S>& data, cl::Buffer& buf) {
+    	cl::Event event = cp.Write (data, buf);
+    	if (event())                             // No transfer if used in place
+    		_uploads.push_back (event);
     }
 
     /**
      * @brief Retrieve result from GPU
      */
     inline void GPUDownload (codeare::opencl::CLProcessor& cp) {
-    	cp.Copy (rfbuf, rf);
-    	cp.Copy ( mbuf,  m);
-    	cp.Copy (icbuf, ic);
+    	std::vector<cl::Event> wait = Tail ();
+    	if (!_conf.async) {                      // Else on their way since CGNR
+    		cp.Read (rfbuf, rf);
+    		cp.Read (icbuf, ic);
+    	}
+    	cp.Read (mbuf, (_conf.planar) ? pm : m, &wait);
+    	cp.Sync ();                              // Only synchronisation with --async
+    	if (_conf.planar)
+    		Interleave (pm, m);
     }
 
 
-    class E {
-    };
-    
     void CGNR (codeare::opencl::CLProcessor& cp) {
 
-        cl::Kernel simacq = cp.MakeKernel("simacq"),
-        		   simexc = cp.MakeKernel("simexc"),
-		           redsig = cp.MakeKernel("redsig"),
-		           intcor = cp.MakeKernel("intcor"),
-		           zerorf = cp.MakeKernel("zerorf");
+        double wtime = 0., hms;
+        std::vector<cl::Event> wait;
+		wtime += Correct (cp);                                   // Intensity correction
+		TuneVectors (cp);                                        // With --tune
+		if (_conf.async) {                                       // Download during the rest
+			wait = Tail ();
+			cp.Read (icbuf, ic, &wait);
+		}
+		if ((hms = HostDesign ()) >= 0.) {                       // Solve on the host
+			wtime += hms;
+			cp.Copy (rf, rfbuf);
+		} else {
+			wtime += Signal  (cp);                               // Acquire and reduce signals
+			if (_conf.iterations)
+				wtime += Refine (cp);                            // Iterate from there
+		}
+		if (_conf.async) {
+			wait = Tail ();
+			cp.Read (rfbuf, rf, &wait);
+		}
+		wtime += Excite  (cp, rfbuf, mbuf);                      // Excite
 
-        float    dt = 1.0e-2;
+		if (!_conf.async)                                        // Else after download
+			printf ("    Running    program ... done; wtime: %.3fs.\n", 1.0e-3*wtime);
 
-        zerorf.setArg( 0, brfbuf);  
+    }
+
+    /**
+     * @brief CGNR on the small tip angle model (stafwd, staadj) for the
+     *        target transverse magnetisation, starting from the time
+     *        reversed RF in rfbuf. Vectors stay on the device, steps are
+     *        device scalars; only the scalars are read back per iteration.
+     *
+     * @param  cp  Assigned processor class
+     * @return     Kernel time in ms
+     */
+    double Refine (codeare::opencl::CLProcessor& cp) {
+
+    	enum {ONE, WW, ZZ0, ZZ1, RR};            // Slots of the device scalars
+
+    	const unsigned nx = 2*nc*nk, ny = 2*nr;
+    	NDData<cplx> d (nr);                     // Target m_xy of modelled voxels
+    	NDData<real> sc (8);
+    	double dd = 0., wtime = 0.;
+    	unsigned it = 0, zk = ZZ0;
+
+    	for (size_t v = 0; v < nr; ++v)
+    		if (tm0[3*v] + tm0[3*v+1] + tm0[3*v+2] > 0.) {
+    			d[v] = cplx (m0[3*v], m0[3*v+1]);
+    			dd  += std::norm (d[v]);
+    		}
+    	if (dd == 0.)
+    		return wtime;
+    	sc[ONE] = 1.;
+
+    	resbuf = cl::Buffer (cp.Context(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+    			sizeof(cplx) * nr, d.Ptr());     // Residual
+    	sbuf   = cl::Buffer (cp.Context(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+    			sizeof(real) * sc.Size(), sc.Ptr());
+    	wbuf   = cl::Buffer (cp.Context(), CL_MEM_READ_WRITE, sizeof(cplx) * nr);
+    	zbuf   = cl::Buffer (cp.Context(), CL_MEM_READ_WRITE, sizeof(cplx) * nc*nk);
+    	dirbuf = cl::Buffer (cp.Context(), CL_MEM_READ_WRITE, sizeof(cplx) * nc*nk);
+    	nbuf   = cl::Buffer (cp.Context(), CL_MEM_READ_WRITE, sizeof(real) * NormGroups (cp));
+
+    	wtime += Forward (cp, rfbuf, wbuf);                     // r = d - E x
+    	wtime += Axpy    (cp, resbuf, wbuf, ONE, ONE, -1., ny);
+    	wtime += Adjoint (cp, resbuf, zbuf);                    // p = z = E^H r
+    	wtime += Axpy    (cp, dirbuf, zbuf, ONE, ONE,  1., nx, true);
+    	wtime += Norm2   (cp, zbuf, nx, ZZ0);
+    	wtime += Norm2   (cp, resbuf, ny, RR);
+    	std::vector<cl::Event> ready = Tail ();
+    	cp.Copy (sbuf, sc, &ready);              // No step if E^H r is zero
+
+    	while (it < _conf.iterations && sc[zk] > 0.) {
+
+    		++it;
+    		const unsigned zn = ZZ0 + ZZ1 - zk;
+    		wtime += Forward (cp, dirbuf, wbuf);                // w = E p
+    		wtime += Norm2   (cp, wbuf, ny, WW);
+    		wtime += Axpy    (cp,  rfbuf, dirbuf, zk, WW,  1., nx); // x += a p
+    		wtime += Axpy    (cp, resbuf,   wbuf, zk, WW, -1., ny); // r -= a w
+    		wtime += Adjoint (cp, resbuf, zbuf);                // z = E^H r
+    		wtime += Norm2   (cp, zbuf,   nx, zn);
+    		wtime += Norm2   (cp, resbuf, ny, RR);
+    		wtime += Xpay    (cp, dirbuf, zbuf, zn, zk, nx);    // p = z + b p
+    		zk = zn;
+
+    		std::vector<cl::Event> wait = Tail ();
+    		cp.Copy (sbuf, sc, &wait);           // Scalars only
+    		if (_conf.verbose)
+    			printf ("    CGNR iteration %u: |r|/|d| %.3e\n", it, sqrt(sc[RR]/dd));
+    		if (sqrt(sc[RR]/dd) < _conf.tolerance)
+    			break;
+
+    	}
+
+    	printf ("    CGNR       ... %u iterations; |r|/|d|: %.3e.\n", it, sqrt(sc[RR]/dd));
+    	Converged ("CGNR", sqrt(sc[RR]/dd));
+
+    	return wtime;
+
+    }
+
+    /**
+     * @brief Voxels of the small tip angle model: non-empty tm0
+     */
+    std::vector<unsigned> Modelled () const {
+    	std::vector<unsigned> vox;
+    	for (unsigned v = 0; v < nr; ++v)
+    		if (tm0[3*v] + tm0[3*v+1] + tm0[3*v+2] > 0.)
+    			vox.push_back (v);
+    	return vox;
+    }
+
+    /**
+     * @brief Whether the least squares design (-l) is cheaper with the
+     *        explicit system matrix: it must fit into --matrix MB, and
+     *        building it plus GEMVs (or the direct solve) must take fewer
+     *        flops than simulating E and E^H in every iteration
+     *
+     * @param  direct  Direct solve cheaper than CG over GEMV
+     */
+    bool UseMatrix (bool& direct) const {
+
+    	using codeare::blas::SystemMatrix;
+
+    	direct = false;
+    	if (!_conf.iterations || !_conf.matrix)
+    		return false;
+
+    	const size_t nv = Modelled().size(), nx = (size_t)nc*nk;
+    	const double budget = 1048576. * _conf.matrix,
+    			sim = 2. * _conf.iterations * SystemMatrix::BuildFlops (nv, nc, nk),
+    			cg  = SystemMatrix::BuildFlops (nv, nc, nk) +
+    					2. * _conf.iterations * SystemMatrix::GemvFlops (nv, nx),
+    			dir = SystemMatrix::BuildFlops (nv, nc, nk) + SystemMatrix::DirectFlops (nv, nx);
+
+    	direct = dir < cg && SystemMatrix::Bytes (nv, nx, true) <= budget;
+    	const bool ret = nv && SystemMatrix::Bytes (nv, nx, false) <= budget &&
+    			std::min (cg, (direct) ? dir : cg) < sim;
+    	if (_conf.verbose)
+    		printf ("    Matrix %zu x %zu: %.0f MB; GFlop simulation %.2f, CG %.2f, direct %.2f.\n",
+    				nv, nx, SystemMatrix::Bytes (nv, nx, false)/1048576., 1.0e-9*sim,
+    				1.0e-9*cg, 1.0e-9*dir);
+
+    	return ret;
+
+    }
+
+    /**
+     * @brief Least squares design (-l) on the host into rf: with NUFFT
+     *        operators (-z), else with the system matrix if that pays off
+     *
+     * @return  Time in ms, negative if the design is left to simulation
+     */
+    double HostDesign () {
+
+    	bool direct;
+    	double ms = -1.;
+
+    	if (!_conf.iterations)
+    		return ms;
+    	if (_conf.nufft)
+    		ms = NUFFTDesign ();
+    	if (ms < 0. && UseMatrix (direct))
+    		ms = MatrixDesign (direct);
+
+    	return ms;
+
+    }
+
+    /**
+     * @brief Least squares design by CG over NUFFT operators (into rf).
+     *        With -x, E and E^H are compared to the exact model on a
+     *        subset of voxels.
+     *
+     * @return  Time in ms, negative if the voxels are not on a lattice
+     */
+    double NUFFTDesign () {
+
+    	typedef std::complex<float> fcplx;
+
+    	const std::vector<unsigned> vox = Modelled ();
+    	NDData<cplx> d (vox.size());             // Target m_xy
+    	NDData<real> lgs = Voxels (gs, 0, nr, 3);
+    	unsigned it = _conf.iterations;
+    	float res = 0.;
+
+    	for (size_t i = 0; i < vox.size(); ++i)
+    		d[i] = cplx (m0[3*vox[i]], m0[3*vox[i]+1]);
+
+    	codeare::nufft::NUFFTOperator E ((const float*) b1.Ptr(), g.Ptr(), r.Ptr(), b0.Ptr(),
+    			lgs.Ptr(), tm0.Ptr(), vox, nr, nc, nk, _dt, _conf.segments);
+    	if (!E.Cartesian()) {
+    		printf ("    NUFFT      ... voxels not on a lattice, skipped.\n");
+    		return -1.;
+    	}
+    	if (_conf.check)
+    		NUFFTCheck (E, vox, lgs);
+
+    	const double ms = E.CG ((const fcplx*) d.Ptr(), _conf.lambda, _conf.tolerance,
+    			(fcplx*) rf.Ptr(), it, res);
+
+    	printf ("    NUFFT      ... %zu x %u, grid %ux%ux%u, %u segments; %u iterations; "
+    			"|r|/|d|: %.3e; setup %.3fs, solve %.3fs.\n", vox.size(), nc*nk, E.Grid()[0],
+    			E.Grid()[1], E.Grid()[2], E.Segments(), it, res, 1.0e-3*E.SetupTime(), 1.0e-3*ms);
+    	Converged ("NUFFT", res);
+
+    	return E.SetupTime() + ms;
+
+    }
+
+    /**
+     * @brief Accuracy and speed of the NUFFT operators against the exact
+     *        model (system matrix rows) on up to 256 voxels
+     */
+    void NUFFTCheck (const codeare::nufft::NUFFTOperator& E, const std::vector<unsigned>& vox,
+    		const NDData<real>& lgs) const {
+
+    	typedef std::complex<float> fcplx;
+
+    	const size_t nv = vox.size(), nx = (size_t)nc*nk, step = std::max<size_t> (1, nv/256);
+    	std::vector<unsigned> sub;
+    	std::vector<size_t>   si;
+    	for (size_t i = 0; i < nv; i += step) {
+    		sub.push_back (vox[i]);
+    		si.push_back (i);
+    	}
+    	const size_t ns = sub.size();
+
+    	std::vector<fcplx> x (nx), y (nv), yz (nv, fcplx(0.f)), ex (nv), ehy (nx), xs (ns), ys (ns), es (nx);
+    	srand (1);
+    	for (size_t j = 0; j < nx; ++j)
+    		x[j] = fcplx (rand()/(float)RAND_MAX - .5f, rand()/(float)RAND_MAX - .5f);
+    	for (size_t i = 0; i < ns; ++i)
+    		yz[si[i]] = ys[i] = fcplx (rand()/(float)RAND_MAX - .5f, rand()/(float)RAND_MAX - .5f);
+
+    	E.Apply (false, &x[0], &ex[0]);
+    	const double fms = E.ApplyTime ();
+    	E.Apply (true, &yz[0], &ehy[0]);
+
+    	codeare::blas::SystemMatrix S ((const float*) b1.Ptr(), g.Ptr(), r.Ptr(), b0.Ptr(),
+    			lgs.Ptr(), tm0.Ptr(), sub, nr, nc, nk, _dt);
+    	S.Apply (false, &x[0], &xs[0]);
+    	S.Apply (true, &ys[0], &es[0]);
+
+    	double ef = 0., nf = 0., ea = 0., na = 0.;
+    	for (size_t i = 0; i < ns; ++i) {
+    		ef += std::norm (ex[si[i]] - xs[i]);
+    		nf += std::norm (xs[i]);
+    	}
+    	for (size_t j = 0; j < nx; ++j) {
+    		ea += std::norm (ehy[j] - es[j]);
+    		na += std::norm (es[j]);
+    	}
+
+    	printf ("    NUFFT      ... vs exact model: |dE|/|E| %.2e, |dE^H|/|E^H| %.2e; "
+    			"E %.1f ms, exact rows %.1f ms (%zu of %zu voxels).\n", sqrt (ef/nf), sqrt (ea/na),
+    			fms, S.BuildTime() * nv / ns, ns, nv);
+
+    }
+
+    /**
+     * @brief Least squares design with the explicit system matrix on the
+     *        host (into rf)
+     *
+     * @param  direct  Direct solve, else CG over GEMV
+     * @return         Time in ms
+     */
+    double MatrixDesign (bool direct) {
+
+    	const std::vector<unsigned> vox = Modelled ();
+    	NDData<cplx> d (vox.size());             // Target m_xy
+    	NDData<real> lgs = Voxels (gs, 0, nr, 3);
+    	unsigned it = _conf.iterations;
+    	float res = 0.;
+    	double ms = -1.;
+
+    	for (size_t i = 0; i < vox.size(); ++i)
+    		d[i] = cplx (m0[3*vox[i]], m0[3*vox[i]+1]);
+
+    	codeare::blas::SystemMatrix E ((const float*) b1.Ptr(), g.Ptr(), r.Ptr(), b0.Ptr(),
+    			lgs.Ptr(), tm0.Ptr(), vox, nr, nc, nk, _dt);
+    	if (direct)
+    		ms = E.Direct ((const std::complex<float>*) d.Ptr(), _conf.lambda,
+    				(std::complex<float>*) rf.Ptr(), res);
+    	if ((direct = (ms >= 0.)) == false)      // Else no LAPACK
+    		ms = E.CG ((const std::complex<float>*) d.Ptr(), _conf.lambda, _conf.tolerance,
+    				(std::complex<float>*) rf.Ptr(), it, res);
+
+    	printf ("    Matrix     ... %zu x %u, %s; |r|/|d|: %.3e; build %.3fs, solve %.3fs.\n",
+    			vox.size(), nc*nk, (direct) ? "direct" : "CG", res, 1.0e-3*E.BuildTime(), 1.0e-3*ms);
+    	if (!direct && _conf.verbose)
+    		printf ("    Matrix     ... %u CG iterations.\n", it);
+    	Converged ("Matrix", res);
+
+    	return E.BuildTime() + ms;
+
+    }
+
+    /**
+     * @brief E: small tip angle excitation (stafwd)
+     *
+     * @param  rfin  RF pulses (nk x nc)
+     * @param  y     Transverse magnetisation (nr)
+     */
+    double Forward (codeare::opencl::CLProcessor& cp, const cl::Buffer& rfin, cl::Buffer& y) {
+
+        cl::Kernel stafwd = cp.MakeKernel("stafwd", _bopts);
+
+        stafwd.setArg( 0,  b1buf); stafwd.setArg( 1,   gbuf);
+        stafwd.setArg( 2,   rfin); stafwd.setArg( 3,   rbuf);
+        stafwd.setArg( 4,  b0buf); stafwd.setArg( 5,  gsbuf);
+        stafwd.setArg( 6, tm0buf); stafwd.setArg( 7,  nr);
+        stafwd.setArg( 8,  nc);    stafwd.setArg( 9,  nk);
+        stafwd.setArg(10,  _dt);   stafwd.setArg(11,   y);
+
+		return Launch (cp, stafwd,         nr,  4);
+
+    }
+
+    /**
+     * @brief E^H: per voxel to brfbuf (staadj), summed over voxels (sumsig);
+     *        with --fused per work-group to pbuf (see FusedAdjoint)
+     *
+     * @param  y      Transverse magnetisation (nr)
+     * @param  rfout  RF pulses (nk x nc)
+     */
+    double Adjoint (codeare::opencl::CLProcessor& cp, const cl::Buffer& y, cl::Buffer& rfout) {
+
+    	if (_conf.fused)
+    		return FusedAdjoint (cp, y, rfout);
+
+        cl::Kernel staadj = cp.MakeKernel("staadj", _bopts),
+        		   sumsig = cp.MakeKernel("sumsig", _bopts);
+
+        staadj.setArg( 0,  b1buf); staadj.setArg( 1,   gbuf);
+        staadj.setArg( 2,      y); staadj.setArg( 3,   rbuf);
+        staadj.setArg( 4,  b0buf); staadj.setArg( 5,  gsbuf);
+        staadj.setArg( 6, tm0buf); staadj.setArg( 7,  nr);
+        staadj.setArg( 8,  nc);    staadj.setArg( 9,  nk);
+        staadj.setArg(10,  _dt);   staadj.setArg(11, brfbuf);
+
+        sumsig.setArg( 0, brfbuf); sumsig.setArg( 1,  nc);
+        sumsig.setArg( 2,  nk);    sumsig.setArg( 3,  nr);
+        sumsig.setArg( 4,  rfout);
+
+		return Launch (cp, staadj, nr, 4) + Launch (cp, sumsig, 2*nk*nc, 0);
+
+    }
+
+    /**
+     * @brief E^H in one pass as FusedAcquire: work-groups accumulate to
+     *        partial signals in pbuf (staadjred), which sumsig combines
+     *
+     * @param  y      Transverse magnetisation (nr)
+     * @param  rfout  RF pulses (nk x nc)
+     */
+    double FusedAdjoint (codeare::opencl::CLProcessor& cp, const cl::Buffer& y, cl::Buffer& rfout) {
+
+        cl::Kernel staadjred = cp.MakeKernel("staadjred", _bopts),
+        		   sumsig    = cp.MakeKernel("sumsig", _bopts);
+
+        const unsigned tl   = 16;                  // Time steps per local tile
+        const size_t   lmem = cp.Device().getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+        size_t         lsz  = std::min (cp.WorkGroupSize (staadjred, 2),
+        		staadjred.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(cp.Device()));
+        while (lsz > 1 && sizeof(real) * 2*(tl+nc)*lsz > lmem)
+        	lsz /= 2;
+        const unsigned ng   = std::min<size_t> (np, (nr+lsz-1)/lsz);
+
+        staadjred.setArg( 0,  b1buf); staadjred.setArg( 1,   gbuf);
+        staadjred.setArg( 2,      y); staadjred.setArg( 3,   rbuf);
+        staadjred.setArg( 4,  b0buf); staadjred.setArg( 5,  gsbuf);
+        staadjred.setArg( 6, tm0buf); staadjred.setArg( 7,  nr);
+        staadjred.setArg( 8,  nc);    staadjred.setArg( 9,  nk);
+        staadjred.setArg(10,  _dt);   staadjred.setArg(11,  tl);
+        staadjred.setArg(12, sizeof(real) * 2*tl*lsz, NULL);
+        staadjred.setArg(13, sizeof(real) * 2*nc*lsz, NULL);
+        staadjred.setArg(14,   pbuf);
+
+        sumsig.setArg( 0,   pbuf); sumsig.setArg( 1,  nc);
+        sumsig.setArg( 2,  nk);    sumsig.setArg( 3,  ng);
+        sumsig.setArg( 4,  rfout);
+
+		return Launch (cp, staadjred, cl::NDRange(ng*lsz), cl::NDRange(lsz)) +
+				Launch (cp, sumsig, 2*nk*nc, 0);
+
+    }
+
+    /**
+     * @brief s[slot] = |a|^2 of n floats: per work-group (norm2), combined (sumpart)
+     */
+    double Norm2 (codeare::opencl::CLProcessor& cp, const cl::Buffer& a, const unsigned n,
+    		const unsigned slot) {
+
+        cl::Kernel norm2   = cp.MakeKernel("norm2", _bopts),
+        		   sumpart = cp.MakeKernel("sumpart", _bopts);
+        size_t lsz = 256;
+        while (lsz > 1 && (lsz > norm2.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(cp.Device()) ||
+        		lsz > sumpart.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(cp.Device())))
+        	lsz /= 2;
+        const unsigned ng = std::min<size_t> (NormGroups (cp), (n+lsz-1)/lsz);
+
+        norm2.setArg(0, a);    norm2.setArg(1, n);
+        norm2.setArg(2, sizeof(real) * lsz, NULL);
+        norm2.setArg(3, nbuf);
+
+        sumpart.setArg(0, nbuf); sumpart.setArg(1, ng);
+        sumpart.setArg(2, sizeof(real) * lsz, NULL);
+        sumpart.setArg(3, sbuf); sumpart.setArg(4, slot);
+
+		return Launch (cp, norm2, cl::NDRange(ng*lsz), cl::NDRange(lsz)) +  // Per work-group
+				Launch (cp, sumpart, cl::NDRange(lsz), cl::NDRange(lsz));    // Combine groups
+
+    }
+
+    /**
+     * @brief Work-groups of norm2: enough to occupy every compute unit
+     */
+    inline static size_t NormGroups (codeare::opencl::CLProcessor& cp) {
+    	return 4 * cp.Device().getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+    }
+
+    /**
+     * @brief y += sign * s[num]/s[den] * x (axpy), or y = x if assign
+     */
+    double Axpy (codeare::opencl::CLProcessor& cp, cl::Buffer& y, const cl::Buffer& x,
+    		const unsigned num, const unsigned den, const float sign, const unsigned n,
+    		const bool assign = false) {
+
+        cl::Kernel axpy = cp.MakeKernel("axpy", _bopts);
+        double wtime = 0.;
+
+        if (assign) {                            // y = 0 + x
+        	cl::Kernel zerorf = cp.MakeKernel("zerorf", _bopts);
+        	zerorf.setArg(0, y);
+        	wtime += Launch (cp, zerorf, n, 0);
+        }
+
+        axpy.setArg(0, y);    axpy.setArg(1, x);
+        axpy.setArg(2, sbuf); axpy.setArg(3, num);
+        axpy.setArg(4, den);  axpy.setArg(5, sign);
+        axpy.setArg(6, n);
+
+		return wtime + Launch (cp, axpy, n, 0);
+
+    }
+
+    /**
+     * @brief p = z + s[num]/s[den] * p (xpay)
+     */
+    double Xpay (codeare::opencl::CLProcessor& cp, cl::Buffer& p, const cl::Buffer& z,
+    		const unsigned num, const unsigned den, const unsigned n) {
+
+        cl::Kernel xpay = cp.MakeKernel("xpay", _bopts);
+
+        xpay.setArg(0, p);    xpay.setArg(1, z);
+        xpay.setArg(2, sbuf); xpay.setArg(3, num);
+        xpay.setArg(4, den);  xpay.setArg(5, n);
+
+		return Launch (cp, xpay, n, 0);
+
+    }
+
+    /**
+     * @brief Partition the voxels over all devices of cp, in proportion to
+     *        their compute units, one queue and host thread per device.
+     *        Every device acquires the partial RF of its voxels, the host
+     *        sums them, then every device excites its voxels with the sum.
+     *
+     * @param  cp  Assigned processor class
+     */
+    void DesignOnDevices (codeare::opencl::CLProcessor& cp) {
+
+    	const size_t nd = cp.NDevices();
+    	std::vector<codeare::opencl::CLProcessor> cps;
+    	std::vector<PulseDesign*> parts;
+    	std::vector<unsigned>     v0 (nd+1, 0);
+    	std::vector<double>       wtime (nd, 0.);
+    	size_t cus = 0, acc = 0;
+
+    	if (_conf.iterations)
+    		fprintf (stderr, "    CGNR needs all voxels on one device; time reversal only.\n");
+    	Vectorise (cp);                          // One vpi for all parts
+    	cp.Program (_bopts);                     // Build for all devices up front
+    	for (size_t d = 0; d < nd; ++d) {
+    		cps.push_back (cp.DeviceProcessor(d));
+    		cus += cps[d].Device().getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+    	}
+    	for (size_t d = 0; d < nd; ++d) {
+    		acc += cps[d].Device().getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+    		v0[d+1] = (unsigned) ((size_t)nr * acc / cus);
+    		parts.push_back (new PulseDesign (*this, v0[d], v0[d+1]-v0[d]));
+    	}
+
+#pragma omp parallel for num_threads(nd) schedule(static,1)
+    	for (int d = 0; d < (int)nd; ++d) {      // Partial RF of every device's voxels
+    		if (!parts[d]->nr)
+    			continue;
+    		parts[d]->GPUUpload (cps[d]);
+    		wtime[d] += parts[d]->Correct (cps[d]);
+    		wtime[d] += parts[d]->Signal  (cps[d]);
+    		cps[d].Copy (parts[d]->rfbuf, parts[d]->rf, &parts[d]->_events);
+    		wtime[d] += parts[d]->Elapsed ();
+    	}
+
+    	for (size_t i = 0; i < rf.Size(); ++i) { // Sum of partial RF
+    		rf[i] = 0.;
+    		for (size_t d = 0; d < nd; ++d)
+    			if (parts[d]->nr)
+    				rf[i] += parts[d]->rf[i];
+    	}
+
+#pragma omp parallel for num_threads(nd) schedule(static,1)
+    	for (int d = 0; d < (int)nd; ++d) {      // Excite every device's voxels
+    		if (!parts[d]->nr)
+    			continue;
+    		parts[d]->rf = rf;
+    		cps[d].Copy (parts[d]->rf, parts[d]->rfbuf);
+    		wtime[d] += parts[d]->Excite (cps[d], parts[d]->rfbuf, parts[d]->mbuf);
+    		parts[d]->CopyM (cps[d], parts[d]->mbuf, parts[d]->m, &parts[d]->_events);
+    		cps[d].Copy (parts[d]->icbuf, parts[d]->ic, &parts[d]->_events);
+    		wtime[d] += parts[d]->Elapsed ();
+    	}
+
+    	for (size_t d = 0; d < nd; ++d) {
+    		std::copy (parts[d]->m.Ptr(), parts[d]->m.Ptr() + 3*parts[d]->nr, m.Ptr() + 3*v0[d]);
+    		std::copy (parts[d]->ic.Ptr(), parts[d]->ic.Ptr() + parts[d]->nr, ic.Ptr() + v0[d]);
+            printf ("    Device %zu: voxels [%u, %u) ... done; wtime: %.3fs.\n",
+            		d, v0[d], v0[d+1], 1.0e-3*wtime[d]);
+    		delete parts[d];
+    	}
+        printf ("    Running    program ... done; wtime: %.3fs.\n",
+        		1.0e-3 * *std::max_element (wtime.begin(), wtime.end()));
+
+    	if (_conf.check) {                       // Reference: all voxels on the first device
+    		GPUUpload (cp);
+    		Correct (cp);
+    		cp.Copy (rf, rfbuf);
+    		cp.Copy (Layout (m, pm), mbuf);
+    		CrossCheck (cp);
+    	}
+
+    }
+
+    /**
+     * @brief Gather the ranks' m and ic on rank 0, which reports and
+     *        optionally checks against the native engine on all voxels
+     *
+     * @param mp     MPI ranks
+     * @param wtime  This rank's time in ms
+     */
+    void Assemble (const codeare::mpi::MPIProcessor& mp, const double wtime) {
+
+    	Scatter ();
+
+    	NDData<real> mg, icg;
+    	if (!mp.Rank()) {
+    		mg  = NDData<real> (3,_nvox);
+    		icg = NDData<real> (_nvox);
+    	}
+    	mp.Gather ((nr) ?  m.Ptr() : 0, 3*nr, (mp.Rank()) ? 0 :  mg.Ptr());
+    	mp.Gather ((nr) ? ic.Ptr() : 0,   nr, (mp.Rank()) ? 0 : icg.Ptr());
+    	const double wmax = mp.Max (wtime);
+
+    	if (_conf.verbose)
+            printf ("    Rank %d: voxels [%u, %u) ... done; wtime: %.3fs.\n",
+            		mp.Rank(), _v0, _v0+nr, 1.0e-3*wtime);
+    	if (mp.Rank())
+    		return;
+
+    	m  = mg;
+    	ic = icg;
+        printf ("    Running    MPI     ... done (%d ranks); wtime: %.3fs.\n",
+        		mp.Size(), 1.0e-3*wmax);
+
+    	if (_conf.check) {                       // Reference: all voxels on rank 0
+    		PulseDesign whole (_in_file, "", _conf);
+    		double rtime = whole.Native (codeare::shm::SHMProcessor(), whole.rf, whole.m, whole.ic, true);
+    		whole.Scatter ();
+    		Compare ("native", rtime, whole.rf, whole.m);
+    	}
+
+    }
+
+    /**
+     * @brief Run kern and wait or, with --async, enqueue it after the
+     *        previously enqueued kernel and return at once
+     *
+     * @return  Kernel time in ms (0 if enqueued, see Elapsed)
+     */
+    double Launch (codeare::opencl::CLProcessor& cp, const cl::Kernel& kern,
+    		const size_t nkern, const size_t wsize) {
+    	if (_conf.tune && Repeatable (kern)) {   // Inputs complete before timing
+    		std::vector<cl::Event> wait = Tail ();
+    		if (!wait.empty())
+    			cl::Event::waitForEvents (wait);
+    		cp.Tune (kern, nkern, wsize);
+    	}
+    	if (!_conf.async)
+    		return cp.Run (kern, nkern, wsize, _conf.verbose);
+    	std::vector<cl::Event> wait = Tail ();
+    	_events.push_back (cp.Enqueue (kern, nkern, wsize, &wait));
+    	_enames.push_back (kern.getInfo<CL_KERNEL_FUNCTION_NAME>());
+    	return 0.;
+    }
+
+    double Launch (codeare::opencl::CLProcessor& cp, const cl::Kernel& kern,
+    		const cl::NDRange& global, const cl::NDRange& local) {
+    	if (!_conf.async)
+    		return cp.Run (kern, global, local, _conf.verbose);
+    	std::vector<cl::Event> wait = Tail ();
+    	_events.push_back (cp.Enqueue (kern, global, local, &wait));
+    	_enames.push_back (kern.getInfo<CL_KERNEL_FUNCTION_NAME>());
+    	return 0.;
+    }
+
+    /**
+     * @brief Kernel overwrites its output, so the tuner may run it
+     *        repeatedly (axpy and xpay update theirs in place)
+     */
+    static bool Repeatable (const cl::Kernel& kern) {
+    	const std::string name = kern.getInfo<CL_KERNEL_FUNCTION_NAME>().c_str();
+    	return name != "axpy" && name != "xpay";
+    }
+
+    /**
+     * @brief Wait-list of the next enqueued kernel: the last one, or the
+     *        uploads for the first
+     */
+    std::vector<cl::Event> Tail () const {
+    	return (_events.empty()) ? _uploads : std::vector<cl::Event>(1, _events.back());
+    }
+
+    /**
+     * @brief Kernel times of the enqueued chain, once synchronised; clears it
+     *
+     * @return  Sum of kernel times in ms
+     */
+    double Elapsed () {
+    	double wtime = 0.;
+    	for (size_t i = 0; i < _events.size(); ++i) {
+    		if (!_events[i]())                   // Failed to enqueue
+    			continue;
+    		double ms = codeare::opencl::CLProcessor::Elapsed (_events[i]);
+    		if (_conf.verbose)
+    			printf ("    Profiled %s (%03.1f ms).\n", _enames[i].c_str(), ms);
+    		wtime += ms;
+    	}
+    	_events.clear();
+    	_enames.clear();
+    	return wtime;
+    }
+
+    /**
+     * @brief Intensity correction
+     *
+     * @param  cp  Assigned processor class
+     * @return     Kernel time in ms
+     */
+    double Correct (codeare::opencl::CLProcessor& cp) {
+
+        cl::Kernel intcor = cp.MakeKernel("intcor", _bopts);
 
         intcor.setArg( 0,  b1buf); intcor.setArg( 1,  nc);
         intcor.setArg( 2,  nr);    intcor.setArg( 3,  icbuf);
 
+		return Launch (cp, intcor,         nr,  8);
+
+    }
+
+    /**
+     * @brief Acquire and reduce the signals to rfbuf with the chosen path
+     *
+     * @param  cp  Assigned processor class
+     * @return     Kernel time in ms
+     */
+    double Signal (codeare::opencl::CLProcessor& cp) {
+		const double wtime = (_conf.fused) ? FusedAcquire (cp, rfbuf) : Acquire (cp, rfbuf);
+		if (!_conf.async)                        // Else timed by Elapsed
+			printf ("    Reduction  %-7s ... %.3f ms.\n", Reduction (_conf), _redms);
+		return wtime;
+    }
+
+    /**
+     * @brief Name of conf's signal reduction
+     */
+    inline static const char* Reduction (const DesignConfig& conf) {
+    	return (conf.fused) ? "fused" : (conf.tree) ? "tree" : "serial";
+    }
+
+    /**
+     * @brief Excite with RF pulses
+     *
+     * @param  cp     Assigned processor class
+     * @param  rfin   RF pulses (nk x nc)
+     * @param  mout   Excited magnetisation (3 x nr)
+     * @return        Kernel time in ms
+     */
+    const double Excite (codeare::opencl::CLProcessor& cp,
+    		const cl::Buffer& rfin, cl::Buffer& mout) {
+
+        const bool vec = _conf.vpi > 1 && !_conf.scan;
+        cl::Kernel simexc = cp.MakeKernel((_conf.scan) ? "simexcscan" :
+        		(vec) ? "simexcvec" : "simexc", _bopts);
+        double wtime = 0.;
+
+        if (_conf.rftime) { // Channels of a time step contiguous
+        	cl::Kernel rftime = cp.MakeKernel("rftime", _bopts);
+        	rftime.setArg( 0,   rfin); rftime.setArg( 1,  nc);
+        	rftime.setArg( 2,  nk);    rftime.setArg( 3, rftbuf);
+        	const size_t lsz = cp.WorkGroupSize (rftime, 1);
+        	wtime += Launch (cp, rftime, cl::NDRange(((nc*nk+lsz-1)/lsz)*lsz), cl::NDRange(lsz));
+        }
+
+        simexc.setArg( 0,  b1buf); simexc.setArg( 1,   gbuf);
+        simexc.setArg( 2, (_conf.rftime) ? rftbuf : rfin);
+        simexc.setArg( 3,   rbuf);
+        simexc.setArg( 4,  b0buf); simexc.setArg( 5,  gsbuf);
+        simexc.setArg( 6, tm0buf); simexc.setArg( 7,  nr);
+        simexc.setArg( 8,  nc);    simexc.setArg( 9,  nk);
+        simexc.setArg(10,  _dt);
+
+        if (_conf.scan) { // One work-group per voxel, parallel in time
+        	const size_t lsz = ScanSize (cp, simexc);
+        	simexc.setArg(11, sizeof(real) * 4*lsz, NULL);
+        	simexc.setArg(12,   mout);
+        	return wtime + Launch (cp, simexc, cl::NDRange(nr*lsz), cl::NDRange(lsz));
+        }
+
+        simexc.setArg(11,   mout);
+
+        if (vec) { // vpi voxels per work-item
+        	return wtime + Launch (cp, simexc, VectorItems (cp.WorkGroupSize (simexc, 4)), 4);
+        }
+
+		return wtime + Launch (cp, simexc,         nr,  4); // Excite
+
+    }
+
+    /**
+     * @brief Acquire every voxel's signal to brfbuf and reduce
+     *
+     * @param  cp     Assigned processor class
+     * @param  rfout  Reduced signal (nk x nc)
+     * @return        Kernel time in ms
+     */
+    const double Acquire (codeare::opencl::CLProcessor& cp, cl::Buffer& rfout) {
+
+        const bool vec = _conf.vpi > 1 && !_conf.scan;
+        cl::Kernel simacq = cp.MakeKernel((_conf.scan) ? "simacqscan" :
+        		(vec) ? "simacqvec" : "simacq", _bopts),
+		           redsig = cp.MakeKernel("redsig", _bopts),
+		           zerorf = cp.MakeKernel("zerorf", _bopts);
+
+        zerorf.setArg( 0, brfbuf);  
+
         simacq.setArg( 0,  b1buf); simacq.setArg( 1,   gbuf);
         simacq.setArg( 2,   rbuf); simacq.setArg( 3,  b0buf);
         simacq.setArg( 4,  gsbuf); simacq.setArg( 5,  m0buf);
         simacq.setArg( 6,  icbuf); simacq.setArg( 7,  nr);
         simacq.setArg( 8,  nc);    simacq.setArg( 9,  nk);
-        simacq.setArg(10,  dt);    simacq.setArg(11, brfbuf);
+        simacq.setArg(10,  _dt);
+
+        double wtime = 0.;
+        wtime += Launch (cp, zerorf, 2*nk*nc*nr, 16); // Reset
+
+        if (_conf.scan) { // One work-group per voxel, parallel in time
+        	const size_t lsz = ScanSize (cp, simacq);
+        	simacq.setArg(11, sizeof(real) * lsz, NULL);
+        	simacq.setArg(12, brfbuf);
+        	wtime += Launch (cp, simacq, cl::NDRange(nr*lsz), cl::NDRange(lsz));
+        } else if (vec) { // vpi voxels per work-item
+        	simacq.setArg(11, brfbuf);
+        	wtime += Launch (cp, simacq, VectorItems (cp.WorkGroupSize (simacq, 4)), 4);
+        } else {
+        	simacq.setArg(11, brfbuf);
+        	wtime += Launch (cp, simacq,     nr,  4); // Acquire
+        }
+
+		if (_conf.tree)
+			return wtime + (_redms = TreeReduce (cp, rfout));
 
         redsig.setArg( 0, brfbuf); redsig.setArg( 1,  jbuf);
         redsig.setArg( 2,  nc);    redsig.setArg( 3,  nk);
-        redsig.setArg( 4,  nr);    redsig.setArg( 5,  rfbuf);
+        redsig.setArg( 4,  nr);    redsig.setArg( 5,  rfout);
 
-        simexc.setArg( 0,  b1buf); simexc.setArg( 1,   gbuf);
-        simexc.setArg( 2,  rfbuf); simexc.setArg( 3,   rbuf);
-        simexc.setArg( 4,  b0buf); simexc.setArg( 5,  gsbuf);
-        simexc.setArg( 6, tm0buf); simexc.setArg( 7,  nr);
-        simexc.setArg( 8,  nc);    simexc.setArg( 9,  nk);
-        simexc.setArg(10,  dt);    simexc.setArg(11,   mbuf);
+		_redms = Launch (cp, redsig,    2*nk*nc,  0); // Reduce signals
+
+		return wtime + _redms;
+
+    }
+
+    /**
+     * @brief Two-level reduction of brfbuf: local-memory trees over voxel
+     *        tiles to np partials in pbuf, then combine to rfout.
+     *
+     * @return  Kernel time in ms
+     */
+    const double TreeReduce (codeare::opencl::CLProcessor& cp, cl::Buffer& rfout) {
+
+        cl::Kernel redtree = cp.MakeKernel("redtree", _bopts),
+		           redpart = cp.MakeKernel("redpart", _bopts);
+
+        const size_t   nrf  = 2*nk*nc;
+        const size_t   lx   = 16;                  // Samples per group (coalesced)
+        size_t         ly   = 16;                  // Voxel rows per group (power of 2)
+        while (lx*ly > redtree.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(cp.Device()))
+        	ly /= 2;
+        const unsigned nt   = std::min<size_t> (np, (nr+ly-1)/ly);
+
+        redtree.setArg( 0, brfbuf); redtree.setArg( 1,  nc);
+        redtree.setArg( 2,  nk);    redtree.setArg( 3,  nr);
+        redtree.setArg( 4, sizeof(real) * lx*ly, NULL);
+        redtree.setArg( 5,   pbuf);
+
+        redpart.setArg( 0,   pbuf); redpart.setArg( 1,  jbuf);
+        redpart.setArg( 2,  nc);    redpart.setArg( 3,  nk);
+        redpart.setArg( 4,  nt);    redpart.setArg( 5, rfout);
 
         double wtime = 0.;
-        wtime += cp.Run (zerorf, 2*nk*nc*nr, 16, _verbose); // Reset
-		wtime += cp.Run (intcor,         nr,  8, _verbose); // Intensity correction
-		wtime += cp.Run (simacq,         nr,  4, _verbose); // Acquire
-		wtime += cp.Run (redsig,    2*nk*nc,  0, _verbose); // Reduce signals
-		wtime += cp.Run (simexc,         nr,  4, _verbose); // Excite
+		wtime += Launch (cp, redtree, cl::NDRange(((nrf+lx-1)/lx)*lx, nt*ly),
+				cl::NDRange(lx, ly));             // Reduce voxel tiles
+		wtime += Launch (cp, redpart,   nrf,  0); // Combine tiles
+
+		return wtime;
+
+    }
+
+    /**
+     * @brief Acquire and reduce in one pass. Work-groups accumulate to
+     *        np partial signals in pbuf, which are then combined to rfbuf.
+     *
+     * @param  cp     Assigned processor class
+     * @param  rfout  Reduced signal (nk x nc)
+     * @return        Kernel time in ms
+     */
+    const double FusedAcquire (codeare::opencl::CLProcessor& cp, cl::Buffer& rfout) {
+
+        cl::Kernel simacqred = cp.MakeKernel("simacqred", _bopts),
+		           redpart   = cp.MakeKernel("redpart", _bopts);
+
+        const unsigned tl   = 16;                  // Time steps per local tile
+        const size_t   lmem = cp.Device().getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+        size_t         lsz  = std::min (cp.WorkGroupSize (simacqred, 2),
+        		simacqred.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(cp.Device()));
+        while (lsz > 1 && sizeof(real) * 2*(tl+nc)*lsz > lmem)
+        	lsz /= 2;
+        const unsigned ng   = std::min<size_t> (np, (nr+lsz-1)/lsz);
+        const size_t   nrf  = 2*nk*nc;
+
+        simacqred.setArg( 0,  b1buf); simacqred.setArg( 1,   gbuf);
+        simacqred.setArg( 2,   rbuf); simacqred.setArg( 3,  b0buf);
+        simacqred.setArg( 4,  gsbuf); simacqred.setArg( 5,  m0buf);
+        simacqred.setArg( 6,  icbuf); simacqred.setArg( 7,  nr);
+        simacqred.setArg( 8,  nc);    simacqred.setArg( 9,  nk);
+        simacqred.setArg(10,  _dt);   simacqred.setArg(11,  tl);
+        simacqred.setArg(12, sizeof(real) * 2*tl*lsz, NULL);
+        simacqred.setArg(13, sizeof(real) * 2*nc*lsz, NULL);
+        simacqred.setArg(14,   pbuf);
+
+        redpart.setArg( 0,   pbuf); redpart.setArg( 1,  jbuf);
+        redpart.setArg( 2,  nc);    redpart.setArg( 3,  nk);
+        redpart.setArg( 4,  ng);    redpart.setArg( 5,  rfout);
+
+        double wtime = 0.;
+		wtime += Launch (cp, simacqred, cl::NDRange(ng*lsz), cl::NDRange(lsz)); // Acquire and reduce
+		wtime += Launch (cp, redpart,   nrf,  0);                              // Combine groups
+		_redms = wtime;                          // Reduction not separable
+
+		return wtime;
+
+    }
+
+    /**
+     * @brief Rerun the reference kernels (simacq, serial redsig, simexc)
+     *        on the selected data layouts (planar, rftime, constg, vpi)
+     *        and report their timing and deviation from the selected path.
+     *        The excitation is fed the selected RF so that both stages
+     *        are compared in isolation.
+     */
+    void CrossCheck (codeare::opencl::CLProcessor& cp) {
+
+    	NDData<cplx> rfref (nk,nc);
+    	NDData<real> mref  (size(m0));
+    	cl::Buffer   rfrefbuf (cp.Context(), CL_MEM_READ_WRITE, sizeof(cplx) * nc*nk),
+    			     mrefbuf  (cp.Context(), CL_MEM_READ_WRITE, sizeof(real) * 3*nr);
+
+    	DesignConfig conf  = _conf;   // Reference: default choices on the same layouts
+    	std::string  bopts = _bopts;
+    	const double redms = _redms;  // Selected reduction
+    	_conf         = DesignConfig();
+    	_conf.verbose = conf.verbose;
+    	_conf.planar  = conf.planar;  // Buffers stay as uploaded
+    	_conf.rftime  = conf.rftime;
+    	_conf.constg  = conf.constg;
+    	_conf.vpi     = conf.vpi;
+    	_bopts        = _conf.BuildOptions() + ShapeOptions() + VectorOptions();
+
+    	double wtime = 0.;
+    	wtime += Acquire (cp, rfrefbuf);
+    	wtime += Excite  (cp, rfbuf, mrefbuf);
+    	if (!conf.async && redms > 0.)           // Selected one timed on this device
+    		printf ("    Reduction  %-7s ... %.3f ms; reference %s: %.3f ms.\n", Reduction (conf), redms,
+    				Reduction (_conf), _redms);
 
-        printf ("    Running    program ... done; wtime: %.3fs.\n", 1.0e-3*wtime);
+    	_conf  = conf;
+    	_bopts = bopts;
+
+    	cp.Copy (rfrefbuf, rfref);
+    	CopyM   (cp, mrefbuf, mref);
+    	cp.Copy (   rfbuf,    rf);
+    	CopyM   (cp,    mbuf,    m);
+
+    	Compare ("", wtime, rfref, mref);
+
+    	NDData<real> icref (nr);                 // Native engine, whole design
+    	wtime = Native (codeare::shm::SHMProcessor(), rfref, mref, icref, true);
+    	Compare ("native", wtime, rfref, mref);
+
+    }
+
+    /**
+     * @brief Report rf and m against a reference and fail the run if
+     *        either deviates by more than CHECK_TOL of its maximum
+     *
+     * @param ref    Reference name
+     * @param wtime  Reference time in ms
+     * @param rfref  Reference RF
+     * @param mref   Reference magnetisation
+     */
+    void Compare (const char* ref, const double wtime, const NDData<cplx>& rfref,
+    		const NDData<real>& mref) {
+    	const double drf = MaxAbsDiff (rf, rfref), arf = MaxAbs (rfref),
+    			     dm  = MaxAbsDiff (m,  mref),  am  = MaxAbs (mref);
+    	printf ("    Cross-check %-6s ... reference wtime: %.3fs; max|drf|: %.2e (of %.2e), max|dm|: %.2e (of %.2e).\n",
+    			ref, 1.0e-3*wtime, drf, arf, dm, am);
+    	if (drf > CHECK_TOL * arf || dm > CHECK_TOL * am) {
+    		fprintf (stderr, "    Cross-check failed: deviation above %.0e of the reference.\n",
+    				CHECK_TOL);
+    		_failed = true;
+    	}
+    }
+
+    /**
+     * @brief With -x, fail the run if a least squares design (-l) ends
+     *        with |r|/|d| at or above the tolerance (-r)
+     *
+     * @param solver  Solver name
+     * @param res     Final |r|/|d|
+     */
+    void Converged (const char* solver, const double res) {
+    	if (_conf.check && !(res < _conf.tolerance)) {
+    		fprintf (stderr, "    %s failed: |r|/|d| %.3e not below the tolerance %.0e.\n",
+    				solver, res, _conf.tolerance);
+    		_failed = true;
+    	}
+    }
+
+    /**
+     * @brief Work-group size for the time-parallel kernels:
+     *        power of two, at most nk and the kernel's limit
+     */
+    inline size_t ScanSize (codeare::opencl::CLProcessor& cp, const cl::Kernel& kern) const {
+    	size_t lsz = 64;
+    	while (lsz > 1 && (lsz > nk ||
+    			lsz > kern.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(cp.Device())))
+    		lsz /= 2;
+    	return lsz;
+    }
+
+    /**
+     * @brief Voxels per work-item of simacq and simexc unless given: the
+     *        tuned one, left to TuneVectors with --tune, else the native
+     *        float vector width of CPU devices, else 1
+     */
+    inline void Vectorise (codeare::opencl::CLProcessor& cp) {
+    	size_t vpi = 0;
+    	if (!_conf.vpi && cp.Tuned ("vpi", nr, vpi))
+    		_conf.vpi = (unsigned) vpi;
+    	if (!_conf.vpi && _conf.tune && cp.NDevices() == 1)
+    		return;
+    	if (!_conf.vpi) {
+    		const cl_uint w = (cp.Device().getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_CPU) ?
+    				cp.Device().getInfo<CL_DEVICE_NATIVE_VECTOR_WIDTH_FLOAT>() : 1;
+    		_conf.vpi = (w >= 16) ? 16 : (w >= 8) ? 8 : (w >= 4) ? 4 : 1;
+    	}
+    	if (_conf.vpi > 1 && _bopts.find ("-DVPI=") == std::string::npos) {
+    		_bopts += VectorOptions ();
+    		if (_conf.verbose)
+    			printf ("    Vectorised simacq and simexc ... %u voxels per work-item.\n", _conf.vpi);
+    	}
+    }
+
+    /**
+     * @brief With --tune and vpi neither given nor tuned: time the
+     *        acquisition with 1, 4, 8 and 16 voxels per work-item and
+     *        keep the fastest. Needs the intensity correction.
+     */
+    void TuneVectors (codeare::opencl::CLProcessor& cp) {
+
+    	if (!_conf.tune || _conf.vpi || _conf.scan || _conf.fused)
+    		return;
+
+    	const std::string bopts = _bopts;
+    	const bool async = _conf.async;
+    	unsigned best = 1;
+    	double   bestms = -1.;
+
+    	_conf.async = false;                     // Timed one by one
+    	for (_conf.vpi = 1; _conf.vpi <= 16; _conf.vpi *= (_conf.vpi == 1) ? 4 : 2) {
+    		_bopts = bopts + VectorOptions ();
+    		const double ms = Acquire (cp, rfbuf);
+    		if (cp.Status() == CL_SUCCESS && (bestms < 0. || ms < bestms)) {
+    			best   = _conf.vpi;
+    			bestms = ms;
+    		}
+    	}
+    	_conf.async = async;
+
+    	_conf.vpi = best;
+    	_bopts    = bopts + VectorOptions ();
+    	if (bestms < 0.)                         // Nothing ran, nothing learnt
+    		return;
+    	cp.StoreTuned ("vpi", nr, best);
+    	printf ("    Tuned      vpi for %u ... %u voxels per work-item (%03.1f ms).\n",
+    			nr, best, bestms);
+
+    }
+
+    /**
+     * @brief -DVPI for more than one voxel per work-item
+     */
+    inline std::string VectorOptions () const {
+    	std::stringstream opts;
+    	if (_conf.vpi > 1)
+    		opts << "-DVPI=" << _conf.vpi << " ";
+    	return opts.str();
+    }
+
+    /**
+     * @brief Work-items of the VPI kernels: nr/vpi rounded up to whole
+     *        work-groups of lsz
+     */
+    inline size_t VectorItems (const size_t lsz) const {
+    	const size_t items = (nr + _conf.vpi - 1) / _conf.vpi;
+    	return ((items + lsz - 1) / lsz) * lsz;
+    }
+
+    /**
+     * @brief Build options for the data shape: kernels that keep the
+     *        sensitivities in private memory are specialised for nc > 8;
+     *        with --specialise nc, nk and dt become compile-time constants;
+     *        g and j (--const-g) and time-major RF go to constant memory
+     *        as far as they fit the 64 kB every device has. Every distinct shape is built once
+     *        (CLProcessor::Program).
+     */
+    inline std::string ShapeOptions () const {
+    	std::stringstream opts;
+    	size_t cmem = 0;                      // Of the minimum constant buffer
+    	if (nc > 8)
+    		opts << "-DMAXNC=" << nc << " ";
+    	if (_conf.constg && (cmem += sizeof(real) * 4*nk) <= 65536)
+    		opts << "-DGCONST ";
+    	if (_conf.rftime && cmem + sizeof(cplx) * nc*nk <= 65536)
+    		opts << "-DRFCONST ";
+    	if (_conf.specialise)
+    		opts << "-DNC=" << nc << " -DNK=" << nk << " -DDT="
+    		     << std::scientific << std::setprecision(8) << _dt << "f ";
+    	return opts.str();
+    }
+
+    /**
+     * @brief Voxels [v0, v0+nv) of data with nb values per voxel, stored in
+     *        nch consecutive blocks of nr voxels (b1: nb 1, nch nc; r: nb 3)
+     */
+    template<class S> inline NDData<S>
+    Voxels (const NDData<S>& data, const unsigned v0, const unsigned nv,
+    		const unsigned nb, const unsigned nch = 1) const {
+    	NDData<S> ret (nb*nv*nch);
+    	for (size_t c = 0; c < nch; ++c)
+    		for (size_t i = 0; i < nb*nv; ++i) {
+    			size_t p = c*nb*nr + nb*v0 + i;
+    			if (p < data.Size())       // r3.h5 has short gs
+    				ret[c*nb*nv + i] = data[p];
+    		}
+    	return ret;
+    }
+
+    /**
+     * @brief Voxels vox of data with nb values per voxel, stored in nch
+     *        consecutive blocks of nr voxels (see Voxels)
+     */
+    template<class S> inline NDData<S>
+    Pick (const NDData<S>& data, const std::vector<unsigned>& vox, const unsigned nb,
+    		const unsigned nch = 1) const {
+    	const size_t nv = vox.size();
+    	NDData<S> ret (nb*nv*nch);
+    	for (size_t c = 0; c < nch; ++c)
+    		for (size_t i = 0; i < nv; ++i)
+    			for (size_t b = 0; b < nb; ++b) {
+    				size_t p = c*nb*nr + nb*vox[i] + b;
+    				if (p < data.Size())       // r3.h5 has short gs
+    					ret[c*nb*nv + nb*i + b] = data[p];
+    			}
+    	return ret;
+    }
+
+    /**
+     * @brief Transpose of data as rows x cols, rows fastest
+     */
+    template<class S> inline static NDData<S>
+    Transpose (const NDData<S>& data, const size_t rows, const size_t cols) {
+    	NDData<S> ret (rows*cols);
+    	for (size_t c = 0; c < cols; ++c)
+    		for (size_t i = 0; i < rows; ++i)
+    			ret[c + i*cols] = data[i + c*rows];
+    	return ret;
+    }
+
+    template<class S> inline static double
+    MaxAbsDiff (const NDData<S>& a, const NDData<S>& b) {
+    	double ret = 0.;
+    	for (size_t i = 0; i < a.Size(); ++i)
+    		ret = std::max (ret, (double) std::abs(a[i]-b[i]));
+    	return ret;
+    }
 
+    template<class S> inline static double
+    MaxAbs (const NDData<S>& a) {
+    	double ret = 0.;
+    	for (size_t i = 0; i < a.Size(); ++i)
+    		ret = std::max (ret, (double) std::abs(a[i]));
+    	return ret;
     }
 
 };
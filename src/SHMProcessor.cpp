@@ -0,0 +1,381 @@
+#include "SHMProcessor.hpp"
+
+#include <algorithm>
+#include <vector>
+#include <math.h>
+#include <sys/time.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace codeare::shm;
+
+
+/*
+ * Voxels per vector: one SIMD register of floats
+ */
+#if defined __AVX512F__
+#define SHM_LANES 16
+#elif defined __AVX__
+#define SHM_LANES 8
+#else
+#define SHM_LANES 4
+#endif
+
+static const unsigned W     = SHM_LANES;
+static const float    GAMMA = 42.57748f;
+static const float    TWOPI = 6.283185307179586476925286766559005768394338798750211641949889185f;
+
+
+inline static double
+WallTime () {
+	timeval tv;
+	gettimeofday (&tv, NULL);
+	return 1.0e3 * tv.tv_sec + 1.0e-3 * tv.tv_usec;
+}
+
+
+/*
+ * Rotate m with the matrix of Cayley-Klein parameters (ar + i ai, br + i bi)
+ * (ckrot in sim.cl)
+ */
+inline static void
+ckrot (const float ar, const float ai, const float br, const float bi,
+		float& m0, float& m1, float& m2) {
+
+	const float arar  =    ar*ar,  aiai  =    ai*ai,  arai2 = 2.f*ar*ai,
+			    brbr  =    br*br,  bibi  =    bi*bi,  brbi2 = 2.f*br*bi,
+			    arbi2 = 2.f*ar*bi, aibr2 = 2.f*ai*br, arbr2 = 2.f*ar*br,
+			    aibi2 = 2.f*ai*bi, brmbi = brbr - bibi, brpbi = brbr + bibi,
+			    armai = arar - aiai, arpai = arar + aiai;
+
+	const float t0 = (armai - brmbi)*m0 + ( arai2 - brbi2)*m1 + (arbr2 + aibi2)*m2,
+			    t1 = (-arai2 - brbi2)*m0 + (armai + brmbi)*m1 + (arbi2 - aibr2)*m2,
+			    t2 = (-arbr2 + aibi2)*m0 + (-aibr2 - arbi2)*m1 + (arpai - brpbi)*m2;
+
+	m0 = t0;
+	m1 = t1;
+	m2 = t2;
+
+}
+
+
+/*
+ * Rotate m around n by abs(n) (rotmn in sim.cl)
+ */
+inline static void
+rotmn (const float n0, const float n1, const float n2, float& m0, float& m1, float& m2) {
+
+	const float phi = sqrtf (n0*n0 + n1*n1 + n2*n2);
+
+	if (phi > 0.f) {
+		const float hp = .5f*phi, sp = sinf(hp)/phi;
+		ckrot (cosf(hp), -n2*sp, n1*sp, -n0*sp, m0, m1, m2);
+	}
+
+}
+
+
+SHMProcessor::SHMProcessor (const int nthreads) : _nthreads (nthreads) {
+#ifdef _OPENMP
+	if (_nthreads < 1)
+		_nthreads = omp_get_max_threads();
+#else
+	_nthreads = 1;
+#endif
+}
+
+
+const int SHMProcessor::Threads () const {
+	return _nthreads;
+}
+
+
+const unsigned SHMProcessor::Lanes () {
+	return W;
+}
+
+
+/**
+ * @brief Intensity correction: ic = 1/sum_c |b1_c|^2
+ */
+const double SHMProcessor::IntCor (const float* b1, const unsigned nc, const unsigned nr,
+		float* ic) const {
+
+	double start = WallTime();
+
+#pragma omp parallel for num_threads(_nthreads)
+	for (long v0 = 0; v0 < (long)nr; v0 += W) {
+		const unsigned nl = std::min<unsigned> (W, nr - v0);
+		float acc[SHM_LANES] = {0.f};
+		for (unsigned c = 0; c < nc; ++c) {
+			const float* lb1 = b1 + 2*(v0 + (size_t)c*nr);
+#pragma omp simd
+			for (unsigned l = 0; l < nl; ++l)
+				acc[l] += lb1[2*l]*lb1[2*l] + lb1[2*l+1]*lb1[2*l+1];
+		}
+		for (unsigned l = 0; l < nl; ++l)
+			ic[v0+l] = 1.f/acc[l];
+	}
+
+	return WallTime() - start;
+
+}
+
+
+/*
+ * Per-voxel signals to srep (2*nk*nc*nr), the layout of simacq in sim.cl
+ */
+struct StoreSignals {
+	float*   srep;
+	unsigned nc, nk;
+	inline void operator() (const unsigned t, const unsigned c, const long v0, const unsigned nl,
+			const int* on, const float* sig) const {
+		for (unsigned l = 0; l < nl; ++l)
+			if (on[l]) {
+				const size_t st = 2*((nk-1-t) + (v0+l)*(size_t)nk*nc + (size_t)c*nk);
+				srep[st] = srep[st+1] = sig[l];
+			}
+	}
+};
+
+
+/*
+ * Signals summed over voxels to part (2*nk*nc), as simacqred in sim.cl
+ */
+struct SumSignals {
+	float*   part;
+	unsigned nk;
+	inline void operator() (const unsigned t, const unsigned c, const long, const unsigned nl,
+			const int* on, const float* sig) const {
+		float acc = 0.f;
+		for (unsigned l = 0; l < nl; ++l)
+			if (on[l])
+				acc += sig[l];
+		const size_t st = 2*((nk-1-t) + (size_t)c*nk);
+		part[st]   += acc;
+		part[st+1] += acc;
+	}
+};
+
+
+/*
+ * Time reversed signals of the voxels [v0, v0+W) to sink(t, c, v0, nl, on, sig)
+ */
+template<class S> inline static void
+AcquireBlock (const float* b1, const float* g, const float* r, const float* b0, const float* gs,
+		const float* m0, const float* ic, const unsigned nr, const unsigned nc, const unsigned nk,
+		const float dt, const long v0, const S& sink) {
+
+	const float gdt = GAMMA * TWOPI * dt;
+	const float rdt = 1.0e-3 * dt * TWOPI;
+
+	const unsigned nl = std::min<unsigned> (W, nr - v0);
+	float lm[3][SHM_LANES], lr[3][SHM_LANES], lb0[SHM_LANES], tmp[2][SHM_LANES], sig[SHM_LANES];
+	int   on[SHM_LANES];
+	std::vector<float> ls (2*nc*W);                    // Local sensitivities
+
+	for (unsigned l = 0; l < W; ++l) {                 // Tail lanes repeat the last voxel
+		const size_t pos = v0 + std::min (l, nl-1), os = 3*pos;
+		for (unsigned i = 0; i < 3; ++i) {
+			lm[i][l] = m0[os+i]*ic[pos];
+			lr[i][l] = r[os+i]*gs[os+i];
+		}
+		lb0[l] = b0[pos];
+		on[l]  = (l < nl && lm[0][l] + lm[1][l] + lm[2][l] > 0.f);
+		for (unsigned c = 0; c < nc; ++c) {
+			ls[(2*c  )*W+l] = b1[2*(pos+(size_t)c*nr)  ];
+			ls[(2*c+1)*W+l] = b1[2*(pos+(size_t)c*nr)+1];
+		}
+	}
+
+	if (std::find (on, on+W, 1) == on+W)                // Only empty voxels
+		return;
+
+	for (unsigned t = 0; t < nk; ++t) {
+
+		const unsigned t3 = (nk-1-t)*3;
+		const float    gx = g[t3], gy = g[t3+1], gz = g[t3+2], trdt = t*rdt;
+
+#pragma omp simd
+		for (unsigned l = 0; l < W; ++l) {
+			tmp[0][l] = lm[0][l];
+			tmp[1][l] = lm[1][l];
+			rotmn (0.f, 0.f, - gdt * (-gx*lr[0][l] + -gy*lr[1][l] + -gz*lr[2][l] - trdt*lb0[l]),
+					lm[0][l], lm[1][l], lm[2][l]);
+			tmp[0][l] += lm[0][l];
+			tmp[1][l] += lm[1][l];
+		}
+
+		for (unsigned c = 0; c < nc; ++c) {
+#pragma omp simd
+			for (unsigned l = 0; l < W; ++l)
+				sig[l] = tmp[0][l]*ls[(2*c)*W+l] + tmp[1][l]*ls[(2*c+1)*W+l];
+			sink (t, c, v0, nl, on, sig);
+		}
+
+	}
+
+}
+
+
+/**
+ * @brief Acquire the time reversed signal of every voxel (simacq in sim.cl).
+ *        rf (2*nk*nc*nr) must be zero on entry, empty voxels are skipped.
+ */
+const double SHMProcessor::SimAcq (const float* b1, const float* g, const float* r,
+		const float* b0, const float* gs, const float* m0, const float* ic,
+		const unsigned nr, const unsigned nc, const unsigned nk, const float dt,
+		float* rf) const {
+
+	double start = WallTime();
+	const StoreSignals sink = {rf, nc, nk};
+
+#pragma omp parallel for schedule(dynamic) num_threads(_nthreads)
+	for (long v0 = 0; v0 < (long)nr; v0 += W)
+		AcquireBlock (b1, g, r, b0, gs, m0, ic, nr, nc, nk, dt, v0, sink);
+
+	return WallTime() - start;
+
+}
+
+
+/**
+ * @brief Acquire, sum over voxels and weigh with j in one pass (simacqred
+ *        and redpart in sim.cl): every thread sums its voxels to a partial
+ *        of 2*nk*nc, so no nc*nk*nr signal buffer is needed. Voxels are
+ *        dealt to threads in fixed order, so the result is reproducible.
+ */
+const double SHMProcessor::SimAcqRed (const float* b1, const float* g, const float* r,
+		const float* b0, const float* gs, const float* m0, const float* ic, const float* j,
+		const unsigned nr, const unsigned nc, const unsigned nk, const float dt,
+		float* rf) const {
+
+	double start = WallTime();
+
+	const size_t slen = 2*(size_t)nc*nk;
+	std::vector<float> part (_nthreads*slen, 0.f);     // Per-thread partial signals
+
+#pragma omp parallel num_threads(_nthreads)
+	{
+#ifdef _OPENMP
+		const SumSignals sink = {&part[omp_get_thread_num()*slen], nk};
+#else
+		const SumSignals sink = {&part[0], nk};
+#endif
+#pragma omp for schedule(static,1)
+		for (long v0 = 0; v0 < (long)nr; v0 += W)
+			AcquireBlock (b1, g, r, b0, gs, m0, ic, nr, nc, nk, dt, v0, sink);
+
+#pragma omp for
+		for (long s = 0; s < (long)slen; ++s) {
+			float acc = 0.f;
+			for (int p = 0; p < _nthreads; ++p)
+				acc += part[p*slen+s];
+			rf[s] = acc * j[s%nk];
+		}
+	}
+
+	return WallTime() - start;
+
+}
+
+
+/**
+ * @brief Sum the voxels' signals and weigh with j (redsig in sim.cl)
+ */
+const double SHMProcessor::RedSig (const float* srep, const float* j, const unsigned nc,
+		const unsigned nk, const unsigned nr, float* rf) const {
+
+	double start = WallTime();
+
+	const size_t slen = 2*(size_t)nc*nk, bs = 16*W;
+
+#pragma omp parallel for num_threads(_nthreads)
+	for (long s0 = 0; s0 < (long)slen; s0 += bs) {
+		const size_t ns = std::min (bs, slen - s0);
+		std::vector<float> acc (ns, 0.f);
+		for (size_t r = 0; r < nr; ++r) {
+			const float* lsrep = srep + r*slen + s0;
+#pragma omp simd
+			for (size_t s = 0; s < ns; ++s)
+				acc[s] += lsrep[s];
+		}
+		for (size_t s = 0; s < ns; ++s)
+			rf[s0+s] = acc[s] * j[(s0+s)%nk];
+	}
+
+	return WallTime() - start;
+
+}
+
+
+/**
+ * @brief Excite every voxel with rf (simexc in sim.cl)
+ */
+const double SHMProcessor::SimExc (const float* b1, const float* g, const float* rf,
+		const float* r, const float* b0, const float* gs, const float* m0,
+		const unsigned nr, const unsigned nc, const unsigned nk, const float dt,
+		float* m) const {
+
+	double start = WallTime();
+
+	const float gdt = GAMMA * TWOPI * dt;
+	const float rdt = 1.0e-3 * dt * TWOPI;
+
+#pragma omp parallel for schedule(dynamic) num_threads(_nthreads)
+	for (long v0 = 0; v0 < (long)nr; v0 += W) {
+
+		const unsigned nl = std::min<unsigned> (W, nr - v0);
+		float lm[3][SHM_LANES], lr[3][SHM_LANES], lb0[SHM_LANES], rfs[2][SHM_LANES];
+		int   on[SHM_LANES];
+		std::vector<float> ls (2*nc*W);                    // Local sensitivities
+
+		for (unsigned l = 0; l < W; ++l) {                 // Tail lanes repeat the last voxel
+			const size_t pos = v0 + std::min (l, nl-1), os = 3*pos;
+			for (unsigned i = 0; i < 3; ++i) {
+				lm[i][l] = m0[os+i];
+				lr[i][l] = r[os+i]*gs[os+i];
+			}
+			lb0[l] = b0[pos];
+			on[l]  = (lm[0][l] + lm[1][l] + lm[2][l] > 0.f);
+			for (unsigned c = 0; c < nc; ++c) {
+				ls[(2*c  )*W+l] = b1[2*(pos+(size_t)c*nr)  ];
+				ls[(2*c+1)*W+l] = b1[2*(pos+(size_t)c*nr)+1];
+			}
+		}
+
+		for (unsigned t = 0; t < nk; ++t) {
+
+			const float gx = g[3*t], gy = g[3*t+1], gz = g[3*t+2], trdt = t*rdt;
+
+#pragma omp simd
+			for (unsigned l = 0; l < W; ++l)
+				rfs[0][l] = rfs[1][l] = 0.f;
+			for (unsigned c = 0; c < nc; ++c) {            // Total rf at site
+				const float rr = rf[2*(t+c*nk)], ri = rf[2*(t+c*nk)+1];
+#pragma omp simd
+				for (unsigned l = 0; l < W; ++l) {
+					rfs[0][l] += rr*ls[(2*c)*W+l] - ri*ls[(2*c+1)*W+l];
+					rfs[1][l] += rr*ls[(2*c+1)*W+l] + ri*ls[(2*c)*W+l];
+				}
+			}
+
+#pragma omp simd
+			for (unsigned l = 0; l < W; ++l)
+				rotmn (- rdt * rfs[1][l], rdt * rfs[0][l],
+						- gdt * (gx*lr[0][l] + gy*lr[1][l] + gz*lr[2][l] - trdt*lb0[l]),
+						lm[0][l], lm[1][l], lm[2][l]);
+
+		}
+
+		for (unsigned l = 0; l < nl; ++l)
+			for (unsigned i = 0; i < 3; ++i)
+				m[3*(v0+l)+i] = (on[l]) ? lm[i][l] : 0.f;
+
+	}
+
+	return WallTime() - start;
+
+}
@@ -0,0 +1,53 @@
+#ifndef __SHM_PROCESSOR_HPP__
+#define __SHM_PROCESSOR_HPP__
+
+#include <cstddef>
+
+/**
+ * @brief Native shared memory engine: the reference kernels of sim.cl in
+ *        C++, vectorised across voxels and threaded with OpenMP
+ */
+namespace codeare {
+    namespace shm {
+
+        class SHMProcessor {
+
+        public:
+
+            SHMProcessor (const int nthreads = 0);
+
+            const int Threads () const;
+
+            static const unsigned Lanes ();
+
+            const double IntCor (const float* b1, const unsigned nc, const unsigned nr,
+            		float* ic) const;
+
+            const double SimAcq (const float* b1, const float* g, const float* r,
+            		const float* b0, const float* gs, const float* m0, const float* ic,
+            		const unsigned nr, const unsigned nc, const unsigned nk, const float dt,
+            		float* rf) const;
+
+            const double SimAcqRed (const float* b1, const float* g, const float* r,
+            		const float* b0, const float* gs, const float* m0, const float* ic,
+            		const float* j, const unsigned nr, const unsigned nc, const unsigned nk,
+            		const float dt, float* rf) const;
+
+            const double RedSig (const float* srep, const float* j, const unsigned nc,
+            		const unsigned nk, const unsigned nr, float* rf) const;
+
+            const double SimExc (const float* b1, const float* g, const float* rf,
+            		const float* r, const float* b0, const float* gs, const float* m0,
+            		const unsigned nr, const unsigned nc, const unsigned nk, const float dt,
+            		float* m) const;
+
+        protected:
+
+            int _nthreads; /**!< Worker threads */
+
+        };
+
+    }
+}
+
+#endif //__SHM_PROCESSOR_HPP__
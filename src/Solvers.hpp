@@ -0,0 +1,79 @@
+#ifndef __SOLVERS_HPP__
+#define __SOLVERS_HPP__
+
+#include <algorithm>
+#include <complex>
+#include <vector>
+#include <math.h>
+
+/**
+ * @brief Host solvers over linear operators with
+ *        Rows(), Cols(), Frob() (|E|_F^2) and Apply(adjoint, x, y)
+ */
+namespace codeare {
+    namespace solvers {
+
+        inline static double
+        Norm2 (const std::complex<float>* a, const size_t n) {
+        	double ret = 0.;
+        	for (size_t i = 0; i < n; ++i)
+        		ret += std::norm (a[i]);
+        	return ret;
+        }
+
+        /**
+         * @brief min |E x - d|^2 + lambda |x|^2 by CG on the normal equations
+         *
+         * @param  e       Operator E
+         * @param  d       Target (Rows)
+         * @param  lambda  Tikhonov weight relative to the mean of diag(E^H E)
+         * @param  tol     Stop at |E x - d|/|d| below
+         * @param  x       Solution (Cols), starting from 0
+         * @param  it      In: maximum, out: iterations done
+         * @param  res     Out: |E x - d|/|d|; stops early if E^H r vanishes
+         */
+        template<class Op> void
+        CG (const Op& e, const std::complex<float>* d, const float lambda, const float tol,
+        		std::complex<float>* x, unsigned& it, float& res) {
+
+        	typedef std::complex<float> cplx;
+
+        	const size_t nv = e.Rows(), nx = e.Cols();
+        	const float lam = lambda * e.Frob() / nx;    // Mean of diag(E^H E)
+        	const double dd = Norm2 (d, nv);
+        	std::vector<cplx> rv (d, d+nv), w (nv), z (nx), p (nx);
+        	const unsigned maxit = it;
+
+        	std::fill (x, x+nx, cplx(0.f));
+        	e.Apply (true, &rv[0], &z[0]);               // z = E^H r - lambda x
+        	p = z;
+        	double zz = Norm2 (&z[0], nx), rr = dd;
+
+        	for (it = 0; it < maxit && dd > 0. && zz > 0. && sqrt(rr/dd) >= tol; ++it) {
+
+        		e.Apply (false, &p[0], &w[0]);           // w = E p
+        		const float a = zz / (Norm2 (&w[0], nv) + lam * Norm2 (&p[0], nx));
+        		for (size_t j = 0; j < nx; ++j)
+        			x[j] += a * p[j];
+        		for (size_t i = 0; i < nv; ++i)
+        			rv[i] -= a * w[i];
+
+        		e.Apply (true, &rv[0], &z[0]);
+        		for (size_t j = 0; j < nx; ++j)
+        			z[j] -= lam * x[j];
+        		const double zn = Norm2 (&z[0], nx);
+        		for (size_t j = 0; j < nx; ++j)
+        			p[j] = z[j] + (float)(zn/zz) * p[j];
+        		zz = zn;
+        		rr = Norm2 (&rv[0], nv);
+
+        	}
+
+        	res = (dd > 0.) ? sqrt (rr/dd) : 0.;
+
+        }
+
+    }
+}
+
+#endif //__SOLVERS_HPP__
@@ -0,0 +1,184 @@
+#include "SystemMatrix.hpp"
+#include "Solvers.hpp"
+
+#include <algorithm>
+#include <math.h>
+#include <sys/time.h>
+
+using namespace codeare::blas;
+using codeare::solvers::Norm2;
+
+typedef std::complex<float> cplx;
+
+#ifdef HAVE_LAPACK
+extern "C" {
+void cgemv_ (const char* trans, const int* m, const int* n, const cplx* alpha, const cplx* a,
+		const int* lda, const cplx* x, const int* incx, const cplx* beta, cplx* y, const int* incy);
+void cherk_ (const char* uplo, const char* trans, const int* n, const int* k, const float* alpha,
+		const cplx* a, const int* lda, const float* beta, cplx* c, const int* ldc);
+void cposv_ (const char* uplo, const int* n, const int* nrhs, cplx* a, const int* lda, cplx* b,
+		const int* ldb, int* info);
+}
+#endif
+
+static const float GAMMA = 42.57748f;
+static const float TWOPI = 6.283185307179586476925286766559005768394338798750211641949889185f;
+
+
+inline static double
+WallTime () {
+	timeval tv;
+	gettimeofday (&tv, NULL);
+	return 1.0e3 * tv.tv_sec + 1.0e-3 * tv.tv_usec;
+}
+
+
+SystemMatrix::SystemMatrix (const float* b1, const float* g, const float* r, const float* b0,
+		const float* gs, const float* m0, const std::vector<unsigned>& vox,
+		const unsigned nr, const unsigned nc, const unsigned nk, const float dt) :
+		_nv (vox.size()), _nx ((size_t)nc*nk), _frob (0.) {
+
+	double start = WallTime(), frob = 0.;
+
+	const float gdt = GAMMA * TWOPI * dt;
+	const float rdt = 1.0e-3 * dt * TWOPI;
+
+	_e.resize (_nv*_nx);
+
+#pragma omp parallel for schedule(dynamic,16) reduction(+:frob)
+	for (long i = 0; i < (long)_nv; ++i) {      // One row per voxel, as stafwd
+
+		const size_t pos = vox[i], os = 3*pos;
+		const float  lr[3] = {r[os]*gs[os], r[os+1]*gs[os+1], r[os+2]*gs[os+2]};
+		float phi = 0.f;
+
+		for (int t = nk-1; t >= 0; --t) {
+			const float nz = - gdt * (g[3*t]*lr[0] + g[3*t+1]*lr[1] + g[3*t+2]*lr[2] - t*rdt*b0[pos]);
+			const cplx  ep = std::polar (rdt*m0[os+2], phi + .5f*nz);
+			phi += nz;
+			for (size_t c = 0; c < nc; ++c) {
+				const cplx e = ep * cplx (b1[2*(pos+c*nr)], b1[2*(pos+c*nr)+1]);
+				_e[i + (t + c*nk)*_nv] = e;
+				frob += std::norm (e);
+			}
+		}
+
+	}
+
+	_frob    = frob;
+	_buildms = WallTime() - start;
+
+}
+
+
+const double SystemMatrix::Bytes (const size_t nv, const size_t nx, const bool direct) {
+	return sizeof(cplx) * ((double)nv*nx + ((direct) ? (double)nv*nv : 0.));
+}
+
+
+const double SystemMatrix::BuildFlops (const size_t nv, const size_t nc, const size_t nk) {
+	return (double)nv*nk * (8.*nc + 40.);    // sincos about 40
+}
+
+
+const double SystemMatrix::GemvFlops (const size_t nv, const size_t nx) {
+	return 8. * nv*nx;
+}
+
+
+const double SystemMatrix::DirectFlops (const size_t nv, const size_t nx) {
+	return 4.*nv*nv*nx + 4./3.*nv*nv*nv + 2.*GemvFlops (nv, nx);
+}
+
+
+const double SystemMatrix::BuildTime () const {
+	return _buildms;
+}
+
+
+size_t SystemMatrix::Rows () const {
+	return _nv;
+}
+
+
+size_t SystemMatrix::Cols () const {
+	return _nx;
+}
+
+
+double SystemMatrix::Frob () const {
+	return _frob;
+}
+
+
+void SystemMatrix::Apply (const bool adjoint, const cplx* x, cplx* y) const {
+
+#ifdef HAVE_LAPACK
+	const int  m = _nv, n = _nx, one = 1;
+	const cplx a (1.f), b (0.f);
+	cgemv_ ((adjoint) ? "C" : "N", &m, &n, &a, &_e[0], &m, x, &one, &b, y, &one);
+#else
+	if (adjoint) {
+#pragma omp parallel for
+		for (long j = 0; j < (long)_nx; ++j) {
+			cplx acc = 0.f;
+			for (size_t i = 0; i < _nv; ++i)
+				acc += std::conj (_e[i + j*_nv]) * x[i];
+			y[j] = acc;
+		}
+	} else {
+#pragma omp parallel for
+		for (long i = 0; i < (long)_nv; ++i) {
+			cplx acc = 0.f;
+			for (size_t j = 0; j < _nx; ++j)
+				acc += _e[i + j*_nv] * x[j];
+			y[i] = acc;
+		}
+	}
+#endif
+
+}
+
+
+const double SystemMatrix::CG (const cplx* d, const float lambda, const float tol, cplx* x,
+		unsigned& it, float& res) const {
+
+	double start = WallTime();
+
+	codeare::solvers::CG (*this, d, lambda, tol, x, it, res);
+
+	return WallTime() - start;
+
+}
+
+
+const double SystemMatrix::Direct (const cplx* d, const float lambda, cplx* x, float& res) const {
+
+#ifdef HAVE_LAPACK
+	double start = WallTime();
+
+	const int   m = _nv, n = _nx, one = 1;
+	const float a = 1.f, b = 0.f;
+	std::vector<cplx> gram (_nv*_nv), y (d, d+_nv), w (_nv);
+	int info = 0;
+
+	cherk_ ("L", "N", &m, &n, &a, &_e[0], &m, &b, &gram[0], &m); // E E^H + lambda I
+	for (size_t i = 0; i < _nv; ++i)
+		gram[i*(_nv+1)] += lambda * _frob / _nx; // Relative to the mean of diag(E^H E)
+	cposv_ ("L", &m, &one, &gram[0], &m, &y[0], &m, &info);
+	if (info)
+		return -1.;
+	Apply (true, &y[0], x);
+
+	Apply (false, x, &w[0]);                  // Residual
+	for (size_t i = 0; i < _nv; ++i)
+		w[i] -= d[i];
+	const double dd = Norm2 (d, _nv);
+	res = (dd > 0.) ? sqrt (Norm2 (&w[0], _nv) / dd) : 0.;
+
+	return WallTime() - start;
+#else
+	return -1.;
+#endif
+
+}
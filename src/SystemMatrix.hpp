@@ -0,0 +1,87 @@
+#ifndef __SYSTEM_MATRIX_HPP__
+#define __SYSTEM_MATRIX_HPP__
+
+#include <complex>
+#include <vector>
+#include <cstddef>
+
+/**
+ * @brief Explicit small tip angle system matrix (the model of stafwd and
+ *        staadj) for few voxels, solved with BLAS/LAPACK
+ */
+namespace codeare {
+    namespace blas {
+
+        class SystemMatrix {
+
+            typedef std::complex<float> cplx;
+
+        public:
+
+            /**
+             * @brief Build E (vox.size() x nc*nk, column major) in parallel
+             *
+             * @param vox  Modelled voxels
+             */
+            SystemMatrix (const float* b1, const float* g, const float* r, const float* b0,
+            		const float* gs, const float* m0, const std::vector<unsigned>& vox,
+            		const unsigned nr, const unsigned nc, const unsigned nk, const float dt);
+
+            /**
+             * @brief Bytes of E and, for Direct, of E E^H
+             */
+            static const double Bytes (const size_t nv, const size_t nx, const bool direct);
+
+            /**
+             * @brief Floating point operations of building E, of one application
+             *        of E or E^H by simulation, by GEMV and of Direct
+             */
+            static const double BuildFlops  (const size_t nv, const size_t nc, const size_t nk);
+            static const double GemvFlops   (const size_t nv, const size_t nx);
+            static const double DirectFlops (const size_t nv, const size_t nx);
+
+            /**
+             * @brief min |E x - d|^2 + lambda |x|^2 by CG on the normal equations
+             *
+             * @param  d       Target (vox.size())
+             * @param  lambda  Tikhonov weight relative to the mean of diag(E^H E)
+             * @param  x       Solution (nc*nk), starting from 0
+             * @param  it      In: maximum, out: iterations done
+             * @param  res     Out: |E x - d|/|d|
+             * @return         Time in ms
+             */
+            const double CG (const cplx* d, const float lambda, const float tol, cplx* x,
+            		unsigned& it, float& res) const;
+
+            /**
+             * @brief The same through x = E^H (E E^H + lambda I)^-1 d (herk, posv)
+             *
+             * @return         Time in ms, negative if unavailable (no LAPACK)
+             */
+            const double Direct (const cplx* d, const float lambda, cplx* x, float& res) const;
+
+            const double BuildTime () const;
+
+            /**
+             * @brief y = E x or y = E^H x (GEMV)
+             */
+            void Apply (const bool adjoint, const cplx* x, cplx* y) const;
+
+            size_t Rows () const;
+            size_t Cols () const;
+            double Frob () const;
+
+        private:
+
+            std::vector<cplx> _e; /**!< E, column major */
+            size_t _nv;           /**!< Rows: modelled voxels */
+            size_t _nx;           /**!< Columns: nc*nk */
+            double _buildms;      /**!< Time to build */
+            double _frob;         /**!< |E|_F^2 */
+
+        };
+
+    }
+}
+
+#endif //__SYSTEM_MATRIX_HPP__
@@ -1,5 +1,64 @@
 #include "InputParser.hpp"
+#include "MPIProcessor.hpp"
 #include "PulseDesign.hpp"
+#include "SHMProcessor.hpp"
+
+
+/**
+ * @brief Design with the native engine
+ */
+static int
+DesignNative (const std::string& din_uri, const std::string& dout_uri, const DesignConfig& conf) {
+
+	codeare::shm::SHMProcessor sp;
+    PulseDesign<float> pd (din_uri, dout_uri, conf);
+    pd.DesignOn(sp);
+
+    return (pd.Failed()) ? 1 : 0;
+
+}
+
+
+/**
+ * @brief Design voxel slabs on MPI ranks, each on a device or natively
+ */
+static int
+DesignMPI (int* args, char*** argv, const std::vector<unsigned short>& devs,
+		const std::string& code_uri, const std::string& cache_uri,
+		const std::string& din_uri, const std::string& dout_uri, const DesignConfig& conf) {
+
+	using namespace codeare::opencl;
+
+	codeare::mpi::MPIProcessor mp (args, argv);
+    PulseDesign<float> pd (din_uri, dout_uri, conf, mp);
+
+    {
+    	CLProcessor clp (devs);
+    	if (clp.Status() == CL_SUCCESS) {
+    		clp.CacheDir (cache_uri);
+    		clp.TuneFile ((cache_uri.empty()) ? "" : cache_uri + "/tuning");
+    		for (int r = 0; r < 2; ++r) {        // Rank 0 fills the binary cache first
+    			if ((r == 0) == (mp.Rank() == 0))
+    				clp.Build (code_uri, conf.BuildOptions());
+    			mp.Barrier ();
+    		}
+    		if (clp.Status() != CL_SUCCESS)
+    			return 1;
+
+    		CLProcessor dp = clp.DeviceProcessor (mp.Rank() % clp.NDevices());
+    		pd.DesignOn (mp, dp);
+
+    		return (pd.Failed()) ? 1 : 0;
+    	}
+    }                                        // clp released before the fallback
+
+    if (!mp.Rank())
+    	fprintf (stderr, "    No OpenCL device, ranks run the native engine.\n");
+    pd.DesignOn (mp, codeare::shm::SHMProcessor());
+
+    return (pd.Failed()) ? 1 : 0;
+
+}
 
 
 int main (int args, char** argv) {
@@ -7,42 +66,60 @@ int main (int args, char** argv) {
 	std::string code_uri;
 	std::string din_uri;
 	std::string dout_uri;
-	bool verbose;
+	std::string cache_uri;
 	bool query;
 	std::vector<unsigned short> devs;
+	unsigned short nsub;
 	cl_device_type cldtype;
+	DesignConfig conf;
 
-	if (!ParseInput (args, argv, verbose, query, cldtype, devs, code_uri, din_uri, dout_uri))
+	if (!ParseInput (args, argv, query, cldtype, devs, nsub, code_uri, din_uri, dout_uri, cache_uri, conf))
 		return 0;
 
-    using namespace codeare::opencl;
-
-    // GPU platform, devices, program and queue
-    CLProcessor clp (devs);
-    if (clp.Status() != CL_SUCCESS)
-    	return 1;
-    else if (query)
-    	return 0;
-
-    // Build OpenCL program
-    if (code_uri.empty())
-    	code_uri = "src/opencl/sim.cl";
-    clp.Build (code_uri);
-    if (clp.Status() != CL_SUCCESS)
-    	return 1;
-
     if (din_uri.empty())
     	din_uri = "data/r1.h5";
     if (dout_uri.empty())
     	dout_uri  = "out.h5";
+    if (code_uri.empty())
+    	code_uri = "src/opencl/sim.cl";
+
+    if (conf.engine == SHM)
+    	return DesignNative (din_uri, dout_uri, conf);
+    else if (conf.engine == MPI)
+    	return DesignMPI (&args, &argv, devs, code_uri, cache_uri, din_uri, dout_uri, conf);
+
+    using namespace codeare::opencl;
+
+    {
+    	// GPU platform, devices, program and queue
+    	CLProcessor clp (devs);
+    	if (clp.Status() != CL_SUCCESS && query)
+    		return 1;
+    	else if (clp.Status() == CL_SUCCESS) {
+    		if (query)
+    			return 0;
+    		if (nsub > 1 && clp.Partition (nsub) != CL_SUCCESS)
+    			return 1;
+
+    		// Build OpenCL program
+    		clp.CacheDir (cache_uri);
+    		clp.TuneFile ((cache_uri.empty()) ? "" : cache_uri + "/tuning");
+    		clp.Build (code_uri, conf.BuildOptions());
+    		if (clp.Status() != CL_SUCCESS)
+    			return 1;
+
+    		// Setup pulse design
+    		PulseDesign<float> pd (din_uri, dout_uri, conf);
+
+    		// Design.
+    		pd.DesignOn(clp);
 
-    // Setup pulse design
-    PulseDesign<float> pd (din_uri, dout_uri, verbose);
+    		return (pd.Failed()) ? 1 : 0;
+    	}
+    }                                        // clp released before the fallback
 
-    // Design.
-    pd.DesignOn(clp);
-    
-    return 0;
+    fprintf (stderr, "    No OpenCL device, falling back to the native engine.\n");
+    return DesignNative (din_uri, dout_uri, conf);
 
 }
 
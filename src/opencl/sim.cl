@@ -1,30 +1,86 @@
 __constant float GAMMA = 42.57748f;
 __constant float TWOPI = 6.283185307179586476925286766559005768394338798750211641949889185f;
 
+/*
+ * Problem shape. The host may fix channels, time steps and time step at
+ * build time (-DNC, -DNK, -DDT); otherwise the kernel arguments are used.
+ */
+#ifdef NC
+#define NCH NC
+#else
+#define NCH nc
+#endif
+#ifdef NK
+#define NKT NK
+#else
+#define NKT nk
+#endif
+#ifdef DT
+#define DTS DT
+#else
+#define DTS dt
+#endif
+
+/*
+ * Voxel vectors r, gs, m0 and m: 3 x nr interleaved as in the file, or,
+ * built with -DPLANAR, as planar x[nr], y[nr], z[nr] so that neighbouring
+ * work-items load neighbouring addresses
+ */
+#ifdef PLANAR
+#define VOX(a,pos,k) a[(k)*nr+(pos)]
+#else
+#define VOX(a,pos,k) a[3*(pos)+(k)]
+#endif
+
+/*
+ * RF of the excitation: nk x nc as in the file or, built with -DRFTIME,
+ * nc x nk as made by rftime, so that the channels of a time step are
+ * contiguous; with -DRFCONST in constant memory
+ */
+#ifdef RFTIME
+#define RFOS(t,c) (2*((c)+(t)*NCH))
+#else
+#define RFOS(t,c) (2*((t)+(c)*NKT))
+#endif
+#ifdef RFCONST
+#define RFMEM __constant
+#else
+#define RFMEM __global
+#endif
+
+/*
+ * Trajectory g and Jacobian j are read at the same address by all
+ * work-items in lock-step; built with -DGCONST they are bound to constant
+ * memory, fetched once and broadcast
+ */
+#ifdef GCONST
+#define GMEM __constant
+#else
+#define GMEM __global
+#endif
+
+#ifndef MAXNC
+#ifdef NC
+#define MAXNC NC
+#else
+#define MAXNC 8 /* Transmit channels held in private memory; set by host for larger arrays */
+#endif
+#endif
+
 
 __kernel void zerorf (__global float* rf) {
     rf[get_global_id(0)] = 0.;
 }
 
-void rotmn (const float *n, float *m, float *r) {
-    
-	float phi, hp, cp, sp, ar, ai, br, bi, arar, aiai, arai2, brbr,
-		bibi, brbi2, arbi2, aibr2, arbr2, aibi2, brmbi, brpbi,
-		armai, arpai, tmp[3];
+/*
+ * Rotate m with the matrix of Cayley-Klein parameters (ar + i ai, br + i bi)
+ */
+void ckrot (const float ar, const float ai, const float br, const float bi,
+            float *m, float *r) {
+
+	float arar, aiai, arai2, brbr, bibi, brbi2, arbi2, aibr2, arbr2, aibi2,
+		brmbi, brpbi, armai, arpai, tmp[3];
 
-    phi = sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
-    
-    if (phi) { /* Any rotation? */
-        
-        /* Cayley-Klein parameters */
-        hp     =  .5*phi;        
-        cp     =  cos(hp);
-        sp     =  sin(hp)/phi;
-        ar     =  cp;
-        ai     = -n[2]*sp;
-        br     =  n[1]*sp;
-        bi     = -n[0]*sp;
-		
         /* Speed up */
         arar   =    ar*ar;
         aiai   =    ai*ai;
@@ -59,49 +115,127 @@ void rotmn (const float *n, float *m, float *r) {
         m[0]   = tmp[0];
         m[1]   = tmp[1];
         m[2]   = tmp[2];
+
+}
+
+void rotmn (const float *n, float *m, float *r) {
+    
+	float phi, hp, cp, sp, ar, ai, br, bi;
+
+    phi = sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+    
+    if (phi) { /* Any rotation? */
+        
+        /* Cayley-Klein parameters */
+        hp     =  .5*phi;        
+        cp     =  cos(hp);
+        sp     =  sin(hp)/phi;
+        ar     =  cp;
+        ai     = -n[2]*sp;
+        br     =  n[1]*sp;
+        bi     = -n[0]*sp;
+		
+        ckrot (ar, ai, br, bi, m, r);
         
     }
 
 }
 
-__kernel void simacq (const __global float* b1, const __global float*  g, const __global float* r,
+/*
+ * Compose spinors (ar, ai, br, bi); ab = ab2 after ab1:
+ * a = a2 a1 - conj(b2) b1,  b = b2 a1 + conj(a2) b1
+ */
+void spmul (const float *ab2, const float *ab1, float *ab) {
+
+	float tmp[4];
+
+    tmp[0] = ab2[0]*ab1[0] - ab2[1]*ab1[1] - ab2[2]*ab1[2] - ab2[3]*ab1[3];
+    tmp[1] = ab2[0]*ab1[1] + ab2[1]*ab1[0] - ab2[2]*ab1[3] + ab2[3]*ab1[2];
+    tmp[2] = ab2[2]*ab1[0] - ab2[3]*ab1[1] + ab2[0]*ab1[2] + ab2[1]*ab1[3];
+    tmp[3] = ab2[2]*ab1[1] + ab2[3]*ab1[0] + ab2[0]*ab1[3] - ab2[1]*ab1[2];
+
+    ab[0]  = tmp[0];
+    ab[1]  = tmp[1];
+    ab[2]  = tmp[2];
+    ab[3]  = tmp[3];
+
+}
+
+/*
+ * Compose the rotation about n by abs(n) onto the spinor ab
+ */
+void rotsp (const float *n, float *ab) {
+
+	float phi, hp, sp, st[4];
+
+    phi = sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+
+    if (phi) { /* Any rotation? */
+
+        /* Cayley-Klein parameters */
+        hp     =  .5*phi;
+        sp     =  sincos(hp, &st[0])/phi;
+        st[1]  = -n[2]*sp;
+        st[2]  =  n[1]*sp;
+        st[3]  = -n[0]*sp;
+
+        spmul (st, ab, ab);
+
+    }
+
+}
+
+/*
+ * Rotation about z by phi; the acquisition has no RF, so one sincos does
+ * what rotmn does with the full Cayley-Klein parameters.
+ */
+void precess (const float phi, float *m) {
+
+    float c, s = sincos (phi, &c), tmp;
+
+    tmp  = c*m[0] - s*m[1];
+    m[1] = s*m[0] + c*m[1];
+    m[0] = tmp;
+
+}
+
+__kernel void simacq (const __global float* b1, const     GMEM float*  g, const __global float* r,
                       const __global float* b0, const __global float* gs, const __global float* m0,
                       const __global float* ic, const       unsigned  nr, const       unsigned  nc,
                       const       unsigned  nk, const          float  dt,       __global float* rf) {
 
     unsigned pos = get_global_id(0);
-    unsigned  os = pos*3;
     float    nv[3];
     float    lm[3];
-    float    ls[8][2]; /* Local sensitivity */
+    float    ls[MAXNC][2]; /* Local sensitivity */
     float   rot[9];
     float    tm[3];
 
-    float gdt = GAMMA * TWOPI* dt;
-    float rdt = 1.0e-3 * dt * TWOPI;
+    float gdt = GAMMA * TWOPI* DTS;
+    float rdt = 1.0e-3 * DTS * TWOPI;
     float tmp[2];
-    float lr[3] = {r[os]*gs[os],r[os+1]*gs[os+1],r[os+2]*gs[os+2]};
+    float lr[3] = {VOX(r,pos,0)*VOX(gs,pos,0),VOX(r,pos,1)*VOX(gs,pos,1),VOX(r,pos,2)*VOX(gs,pos,2)};
 
     nv[0] = 0.0;
     nv[1] = 0.0;
 
-    lm[0] = m0[os  ]*ic[pos];
-    lm[1] = m0[os+1]*ic[pos];
-    lm[2] = m0[os+2]*ic[pos];
+    lm[0] = VOX(m0,pos,0)*ic[pos];
+    lm[1] = VOX(m0,pos,1)*ic[pos];
+    lm[2] = VOX(m0,pos,2)*ic[pos];
 
     if (lm[0] + lm[1] + lm[2] > 0.0) { // Simulate only if non-zeros voxel
 
         unsigned t, c, t3;
 
         // Local sensitivities (conj) 
-        for (c = 0; c < nc; ++c) {
+        for (c = 0; c < NCH; ++c) {
             unsigned b1os = 2*(pos+c*nr);
             ls[c][0] =  b1[  b1os];
             ls[c][1] =  b1[1+b1os];
         }
 
         // Simulate Bloch on spin 
-        for (t = 0, t3 = (nk-1-t)*3; t < nk; ++t) {
+        for (t = 0, t3 = (NKT-1-t)*3; t < NKT; ++t) {
             
             // lmxy before rotation
             tmp[0] = lm[0];
@@ -113,15 +247,19 @@ __kernel void simacq (const __global float* b1, const __global float*  g, const
                              -g[2+t3]*lr[2] - t * rdt * b0[pos]);
             t3 -= 3;
             // Rotate lm around nv 
+#ifdef PRECESS
+            precess (nv[2], lm);
+#else
             rotmn (nv, lm, rot);
+#endif
 
             // Momentum
             tmp[0] += lm[0];
             tmp[1] += lm[1];
 
-            unsigned st = (nk-1-t)+pos*nk*nc;
-            for (c = 0; c < nc; ++c) {
-                unsigned stcnk = 2*(st+c*nk);
+            unsigned st = (NKT-1-t)+pos*NKT*NCH;
+            for (c = 0; c < NCH; ++c) {
+                unsigned stcnk = 2*(st+c*NKT);
                 rf[stcnk  ] = tmp[0]*ls[c][0]+tmp[1]*ls[c][1];
                 rf[stcnk+1] = tmp[0]*ls[c][0]+tmp[1]*ls[c][1];
             }
@@ -133,19 +271,191 @@ __kernel void simacq (const __global float* b1, const __global float*  g, const
 
 //__kernel double 
 
-__kernel void redsig (const __global float* srep, const __global float* j, 
+__kernel void redsig (const __global float* srep, const     GMEM float* j, 
                       const unsigned nc, const unsigned nk, const unsigned nr, 
                       __global float* rf) {
     unsigned sample = get_global_id(0);
-    unsigned slen   = 2*nc*nk;
+    unsigned slen   = 2*NCH*NKT;
     rf[sample]    = 0.;
     for (unsigned r = 0; r < nr*slen; r += slen)
         rf[sample] += srep[r + sample];
-    rf[sample]   *= j[sample%nk];
+    rf[sample]   *= j[sample%NKT];
     return;
 }
 
 
+/*
+ * First level of the hierarchical signal reduction. 2D range: dim 0 runs
+ * over the 2*nc*nk samples, dim 1 over voxels. Every work-item sums a
+ * strided subset of voxels, the work-group then tree-reduces along dim 1
+ * in local memory and writes one partial per group row for redpart.
+ *
+ * get_local_size(1) must be a power of two.
+ * scratch: get_local_size(0)*get_local_size(1) floats of local memory
+ * part:    2*nc*nk*get_num_groups(1) floats
+ */
+__kernel void redtree (const __global float* srep, const unsigned nc, const unsigned nk,
+                       const unsigned nr, __local float* scratch, __global float* part) {
+
+    unsigned sample = get_global_id(0);
+    unsigned slen   = 2*nc*nk;
+    unsigned lx     = get_local_id(0);
+    unsigned ly     = get_local_id(1);
+    unsigned lsx    = get_local_size(0);
+    float    acc    = 0.;
+
+    if (sample < slen)
+        for (unsigned r = get_global_id(1); r < nr; r += get_global_size(1))
+            acc += srep[r*slen + sample];
+
+    scratch[ly*lsx + lx] = acc;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (unsigned s = get_local_size(1)/2; s > 0; s >>= 1) {
+        if (ly < s)
+            scratch[ly*lsx + lx] += scratch[(ly+s)*lsx + lx];
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (ly == 0 && sample < slen)
+        part[get_group_id(1)*slen + sample] = scratch[lx];
+
+}
+
+
+/*
+ * Fused acquisition and reduction. Every work-group walks over tiles of
+ * get_local_size(0) voxels and accumulates their signals into its own
+ * 2*nc*nk slice of part. No nc*nk*nr signal buffer is needed.
+ *
+ * tl:   Time steps buffered in local memory per pass
+ * sig:  2*tl*get_local_size(0) floats of local memory
+ * sens: 2*nc*get_local_size(0) floats of local memory
+ * part: 2*nc*nk*get_num_groups(0) floats; combined by redpart
+ */
+__kernel void simacqred (const __global float* b1, const     GMEM float*  g, const __global float* r,
+                         const __global float* b0, const __global float* gs, const __global float* m0,
+                         const __global float* ic, const       unsigned  nr, const       unsigned  nc,
+                         const       unsigned  nk, const          float  dt, const unsigned tl,
+                         __local float* sig, __local float* sens, __global float* part) {
+
+    unsigned lid  = get_local_id(0);
+    unsigned lsz  = get_local_size(0);
+    unsigned slen = 2*nc*nk;
+    __global float* prf = part + get_group_id(0)*slen; /* This group's signal */
+
+    float gdt = GAMMA * TWOPI* dt;
+    float rdt = 1.0e-3 * dt * TWOPI;
+
+    unsigned s, t, t0, tn, tt, c, v;
+
+    for (s = lid; s < slen; s += lsz)
+        prf[s] = 0.;
+    barrier(CLK_GLOBAL_MEM_FENCE);
+
+    for (unsigned base = get_group_id(0)*lsz; base < nr; base += get_global_size(0)) {
+
+        unsigned pos = base + lid;
+        float    nv[3] = {0.,0.,0.};
+        float    lm[3] = {0.,0.,0.};
+        float    lr[3] = {0.,0.,0.};
+        float   rot[9];
+        float   tmp[2];
+        float   lb0    = 0.;
+        bool    active = false;
+
+        if (pos < nr) {
+            lm[0]  = VOX(m0,pos,0)*ic[pos];
+            lm[1]  = VOX(m0,pos,1)*ic[pos];
+            lm[2]  = VOX(m0,pos,2)*ic[pos];
+            lr[0]  = VOX(r,pos,0)*VOX(gs,pos,0);
+            lr[1]  = VOX(r,pos,1)*VOX(gs,pos,1);
+            lr[2]  = VOX(r,pos,2)*VOX(gs,pos,2);
+            lb0    = b0[pos];
+            active = (lm[0] + lm[1] + lm[2] > 0.0);
+        }
+
+        // Local sensitivities of this voxel tile (zero for idle voxels)
+        for (c = 0; c < nc; ++c) {
+            unsigned b1os = 2*(pos+c*nr);
+            sens[2*(c*lsz+lid)  ] = active ? b1[  b1os] : 0.;
+            sens[2*(c*lsz+lid)+1] = active ? b1[1+b1os] : 0.;
+        }
+
+        for (t0 = 0; t0 < nk; t0 += tl) {
+
+            tn = min(tl, nk-t0);
+
+            // Simulate Bloch on spin for this tile of time steps
+            for (tt = 0; tt < tn; ++tt) {
+                t      = t0 + tt;
+                tmp[0] = lm[0];
+                tmp[1] = lm[1];
+                if (active) {
+                    unsigned t3 = (nk-1-t)*3;
+                    nv[2] = - gdt * (-g[  t3]*lr[0] +
+                                     -g[1+t3]*lr[1] +
+                                     -g[2+t3]*lr[2] - t * rdt * lb0);
+#ifdef PRECESS
+                    precess (nv[2], lm);
+#else
+                    rotmn (nv, lm, rot);
+#endif
+                }
+                sig[2*(tt*lsz+lid)  ] = active ? tmp[0] + lm[0] : 0.;
+                sig[2*(tt*lsz+lid)+1] = active ? tmp[1] + lm[1] : 0.;
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+
+            // Sum tile over voxels; one (time step, channel) pair per work-item
+            for (s = lid; s < tn*nc; s += lsz) {
+                float acc = 0.;
+                tt = s % tn;
+                c  = s / tn;
+                for (v = 0; v < lsz; ++v)
+                    acc += sig[2*(tt*lsz+v)]*sens[2*(c*lsz+v)] + sig[2*(tt*lsz+v)+1]*sens[2*(c*lsz+v)+1];
+                unsigned stcnk = 2*((nk-1-t0-tt)+c*nk);
+                prf[stcnk  ] += acc;
+                prf[stcnk+1] += acc;
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+
+        }
+    }
+
+}
+
+
+/*
+ * Combine np partial signals of length 2*nc*nk and apply the Jacobian
+ */
+__kernel void redpart (const __global float* part, const     GMEM float* j,
+                       const unsigned nc, const unsigned nk, const unsigned np,
+                       __global float* rf) {
+    unsigned sample = get_global_id(0);
+    unsigned slen   = 2*nc*nk;
+    float    acc    = 0.;
+    if (sample >= slen)
+        return;
+    for (unsigned p = 0; p < np*slen; p += slen)
+        acc += part[p + sample];
+    rf[sample] = acc * j[sample%nk];
+}
+
+
+/*
+ * RF nk x nc to the time-major nc x nk of -DRFTIME
+ */
+__kernel void rftime (const __global float* rf, const unsigned nc, const unsigned nk,
+                      __global float* rft) {
+    unsigned i = get_global_id(0), t = i % nk, c = i / nk;
+    if (i >= nc*nk)
+        return;
+    rft[2*(c+t*nc)  ] = rf[2*i  ];
+    rft[2*(c+t*nc)+1] = rf[2*i+1];
+}
+
+
 __kernel void intcor (__global const float* b1, const unsigned nc,
                       const unsigned nr, __global float* ic) {
 
@@ -156,7 +466,7 @@ __kernel void intcor (__global const float* b1, const unsigned nc,
 		nr2   = 2*nr, pos21nr, pos2nr;
 
 	ic[pos] = 0.;
-	for (unsigned r = 0; r < nr2*nc; r += nr2) {
+	for (unsigned r = 0; r < nr2*NCH; r += nr2) {
 		pos2nr  = pos2  + r; 
 		pos21nr = pos21 + r;
 		ic[pos] += b1[pos2nr]*b1[pos2nr] + b1[pos21nr]*b1[pos21nr];
@@ -165,48 +475,50 @@ __kernel void intcor (__global const float* b1, const unsigned nc,
     
 }
 
-__kernel void simexc (const __global float* b1, const __global float*  g, const __global float* rf,
+__kernel void simexc (const __global float* b1, const     GMEM float*  g, const    RFMEM float* rf,
                       const __global float*  r, const __global float* b0, const __global float* gs,
                       const __global float* m0, const unsigned nr, const unsigned nc, const unsigned nk,
                       const float dt, __global float* m) {
 
 
     unsigned pos = get_global_id(0);
-    int     os = 3 * pos;            /* offset */
     
     float   lm[3] = {0.,0.,1.};       /* Magnetisation */
-    lm[0] = m0[os  ];
-    lm[1] = m0[os+1];
-    lm[2] = m0[os+2];
+    lm[0] = VOX(m0,pos,0);
+    lm[1] = VOX(m0,pos,1);
+    lm[2] = VOX(m0,pos,2);
 
     if (lm[0] + lm[1] + lm[2] > 0.0) { // Simulate only if non-zeros voxel
 
 
     float   nv[3];       /* Rotation axis */
-    float   ls[8][2]; /* Local sensitivity */
+    float   ls[MAXNC][2]; /* Local sensitivity */
     float  rot[9];
     float   tm[3];
-    float   lr[3] = {r[os]*gs[os],r[os+1]*gs[os+1],r[os+2]*gs[os+2]};
+    float   lr[3] = {VOX(r,pos,0)*VOX(gs,pos,0),VOX(r,pos,1)*VOX(gs,pos,1),VOX(r,pos,2)*VOX(gs,pos,2)};
 
-    float  gdt = GAMMA * TWOPI * dt;
-    float  rdt = 1.0e-3 * dt * TWOPI;
+    float  gdt = GAMMA * TWOPI * DTS;
+    float  rdt = 1.0e-3 * DTS * TWOPI;
+#ifdef SPINOR
+    float   ab[4] = {1.,0.,0.,0.}; /* Total rotation (spinor) */
+#endif
 
     unsigned t, c, t3;
     
 	// Local sensitivities
-	for (c = 0; c < nc; ++c) {
+	for (c = 0; c < NCH; ++c) {
 		int cpos = 2*(pos+c*nr);
 		ls[c][0] = b1[cpos];
 		ls[c][1] = b1[cpos+1];
 	}
     
-	for (t = 0, t3 = 0; t < nk; ++t) {
+	for (t = 0, t3 = 0; t < NKT; ++t) {
 		
 		// Total rf at site
 		float rfsr = 0., rfsi = 0.;
         
-		for (c = 0; c < nc; c++) {
-			unsigned rfos = 2*(t+c*nk);
+		for (c = 0; c < NCH; c++) {
+			unsigned rfos = RFOS(t,c);
 			rfsr += rf[rfos]*ls[c][0]-rf[rfos+1]*ls[c][1];
 			rfsi += rf[rfos]*ls[c][1]+rf[rfos+1]*ls[c][0];
 		}
@@ -218,21 +530,742 @@ __kernel void simexc (const __global float* b1, const __global float*  g, const
 						 g[t3++]*lr[1] +
 						 g[t3++]*lr[2] - t*rdt*b0[pos]);
 		
+#ifdef SPINOR
+		// Accumulate rotation around nv by abs(nv)
+		rotsp (nv, ab);
+#else
 		// Rotate lm around nv by abs(nv) 
 		rotmn (nv, lm, rot);
+#endif
 		
 	}
+
+#ifdef SPINOR
+	// Apply total rotation
+	ckrot (ab[0], ab[1], ab[2], ab[3], lm, rot);
+#endif
 	
 	// Store final magnetisation for every spin 
-	m[os  ] = lm[0];
-	m[os+1] = lm[1];
-	m[os+2] = lm[2];
+	VOX(m,pos,0) = lm[0];
+	VOX(m,pos,1) = lm[1];
+	VOX(m,pos,2) = lm[2];
     } else {
-        m[os  ] = 0.;
-        m[os+1] = 0.;
-        m[os+2] = 0.;
+        VOX(m,pos,0) = 0.;
+        VOX(m,pos,1) = 0.;
+        VOX(m,pos,2) = 0.;
     }
     
 	
 }
-    
+
+
+/*
+ * Parallel-in-time excitation for few voxels: one work-group per voxel.
+ * Every work-item composes the spinor of a contiguous chunk of time
+ * steps, the chunks are then combined by a tree in local memory in
+ * log2(get_local_size(0)) steps, which must be a power of two.
+ *
+ * sab: 4*get_local_size(0) floats of local memory
+ */
+__kernel void simexcscan (const __global float* b1, const     GMEM float*  g, const    RFMEM float* rf,
+                          const __global float*  r, const __global float* b0, const __global float* gs,
+                          const __global float* m0, const unsigned nr, const unsigned nc, const unsigned nk,
+                          const float dt, __local float* sab, __global float* m) {
+
+    unsigned pos = get_group_id(0);
+    unsigned lid = get_local_id(0);
+    unsigned lsz = get_local_size(0);
+
+    float   lm[3] = {VOX(m0,pos,0), VOX(m0,pos,1), VOX(m0,pos,2)}; /* Magnetisation */
+    float   ab[4] = {1.,0.,0.,0.};    /* Rotation of this chunk */
+    float   lr[3] = {VOX(r,pos,0)*VOX(gs,pos,0),VOX(r,pos,1)*VOX(gs,pos,1),VOX(r,pos,2)*VOX(gs,pos,2)};
+    float   nv[3];       /* Rotation axis */
+    float   ls[MAXNC][2];    /* Local sensitivity */
+    float  rot[9];
+
+    float  gdt = GAMMA * TWOPI * dt;
+    float  rdt = 1.0e-3 * dt * TWOPI;
+
+    unsigned t, c, s, i;
+    unsigned tb = ( lid   *nk)/lsz;
+    unsigned te = ((lid+1)*nk)/lsz;
+    bool active = (lm[0] + lm[1] + lm[2] > 0.0);
+
+    if (active) {
+
+        // Local sensitivities
+        for (c = 0; c < nc; ++c) {
+            int cpos = 2*(pos+c*nr);
+            ls[c][0] = b1[cpos];
+            ls[c][1] = b1[cpos+1];
+        }
+
+        for (t = tb; t < te; ++t) {
+
+            // Total rf at site
+            float rfsr = 0., rfsi = 0.;
+            for (c = 0; c < NCH; c++) {
+                unsigned rfos = RFOS(t,c);
+                rfsr += rf[rfos]*ls[c][0]-rf[rfos+1]*ls[c][1];
+                rfsi += rf[rfos]*ls[c][1]+rf[rfos+1]*ls[c][0];
+            }
+
+            // Rotation vector
+            nv[0] = - rdt *  rfsi;
+            nv[1] =   rdt *  rfsr;
+            nv[2] = - gdt * (g[3*t  ]*lr[0] +
+                             g[3*t+1]*lr[1] +
+                             g[3*t+2]*lr[2] - t*rdt*b0[pos]);
+
+            rotsp (nv, ab);
+
+        }
+    }
+
+    for (i = 0; i < 4; ++i)
+        sab[4*lid+i] = ab[i];
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // Later chunk after earlier chunk
+    for (s = 1; s < lsz; s <<= 1) {
+        if (lid % (2*s) == 0) {
+            float ab2[4];
+            for (i = 0; i < 4; ++i) {
+                ab [i] = sab[4*lid+i];
+                ab2[i] = sab[4*(lid+s)+i];
+            }
+            spmul (ab2, ab, ab);
+            for (i = 0; i < 4; ++i)
+                sab[4*lid+i] = ab[i];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (lid == 0) {
+        if (active)
+            ckrot (sab[0], sab[1], sab[2], sab[3], lm, rot);
+        else
+            lm[0] = lm[1] = lm[2] = 0.;
+        VOX(m,pos,0) = lm[0];
+        VOX(m,pos,1) = lm[1];
+        VOX(m,pos,2) = lm[2];
+    }
+
+}
+
+
+/*
+ * Parallel-in-time acquisition for few voxels: one work-group per voxel.
+ * Without RF the rotations are about z only and compose by adding their
+ * angles, so the spinor scan reduces to a prefix sum of the per-step
+ * phases. Every work-item sums the phases of a chunk of time steps,
+ * an inclusive scan over the chunks in local memory (log2 depth) gives
+ * each chunk's starting phase and the chunks are then acquired
+ * independently. Output as simacq.
+ *
+ * phs: get_local_size(0) floats of local memory
+ */
+__kernel void simacqscan (const __global float* b1, const     GMEM float*  g, const __global float* r,
+                          const __global float* b0, const __global float* gs, const __global float* m0,
+                          const __global float* ic, const       unsigned  nr, const       unsigned  nc,
+                          const       unsigned  nk, const          float  dt, __local float* phs,
+                          __global float* rf) {
+
+    unsigned pos = get_group_id(0);
+    unsigned lid = get_local_id(0);
+    unsigned lsz = get_local_size(0);
+
+    float    lm[3] = {VOX(m0,pos,0)*ic[pos], VOX(m0,pos,1)*ic[pos], VOX(m0,pos,2)*ic[pos]};
+    float    lr[3] = {VOX(r,pos,0)*VOX(gs,pos,0),VOX(r,pos,1)*VOX(gs,pos,1),VOX(r,pos,2)*VOX(gs,pos,2)};
+    float    ls[MAXNC][2]; /* Local sensitivity */
+    float   tmp[2];
+    float   phi = 0., nz, v;
+
+    float gdt = GAMMA * TWOPI* dt;
+    float rdt = 1.0e-3 * dt * TWOPI;
+
+    unsigned t, c, s;
+    unsigned tb = ( lid   *nk)/lsz;
+    unsigned te = ((lid+1)*nk)/lsz;
+    bool active = (lm[0] + lm[1] + lm[2] > 0.0);
+
+    if (active)
+        for (t = tb; t < te; ++t)
+            phi += - gdt * (-g[3*(nk-1-t)  ]*lr[0] +
+                            -g[3*(nk-1-t)+1]*lr[1] +
+                            -g[3*(nk-1-t)+2]*lr[2] - t * rdt * b0[pos]);
+
+    phs[lid] = phi;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (s = 1; s < lsz; s <<= 1) {
+        v = (lid >= s) ? phs[lid-s] : 0.;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        phs[lid] += v;
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (active) {
+
+        // Local sensitivities (conj)
+        for (c = 0; c < nc; ++c) {
+            unsigned b1os = 2*(pos+c*nr);
+            ls[c][0] =  b1[  b1os];
+            ls[c][1] =  b1[1+b1os];
+        }
+
+        // Precess to the start of this chunk
+        precess (phs[lid] - phi, lm);
+
+        for (t = tb; t < te; ++t) {
+
+            tmp[0] = lm[0];
+            tmp[1] = lm[1];
+
+            nz = - gdt * (-g[3*(nk-1-t)  ]*lr[0] +
+                          -g[3*(nk-1-t)+1]*lr[1] +
+                          -g[3*(nk-1-t)+2]*lr[2] - t * rdt * b0[pos]);
+            precess (nz, lm);
+
+            // Momentum
+            tmp[0] += lm[0];
+            tmp[1] += lm[1];
+
+            unsigned st = (nk-1-t)+pos*nk*nc;
+            for (c = 0; c < nc; ++c) {
+                unsigned stcnk = 2*(st+c*nk);
+                rf[stcnk  ] = tmp[0]*ls[c][0]+tmp[1]*ls[c][1];
+                rf[stcnk+1] = tmp[0]*ls[c][0]+tmp[1]*ls[c][1];
+            }
+        }
+    }
+
+}
+
+
+#ifdef VPI
+/*
+ * VPI voxels per work-item in the lanes of floatv (-DVPI=4, 8 or 16, set
+ * by the host for vector devices). The lanes share every time step's
+ * loads of g and rf. Work-item i runs voxels [VPI*i, VPI*(i+1)); lanes
+ * past nr and empty voxels are computed but not stored.
+ */
+#define VCAT_(a,b) a##b
+#define VCAT(a,b)  VCAT_(a,b)
+typedef VCAT(float,VPI) floatv;
+#define vloadv  VCAT(vload,VPI)
+#define vstorev VCAT(vstore,VPI)
+
+/*
+ * ckrot on floatv lanes
+ */
+void ckrotv (const floatv ar, const floatv ai, const floatv br, const floatv bi, floatv *m) {
+
+    floatv arar  = ar*ar,      aiai  = ai*ai,       arai2 = 2.f*ar*ai,
+           brbr  = br*br,      bibi  = bi*bi,       brbi2 = 2.f*br*bi,
+           arbi2 = 2.f*ar*bi,  aibr2 = 2.f*ai*br,   arbr2 = 2.f*ar*br,
+           aibi2 = 2.f*ai*bi,  brmbi = brbr - bibi, brpbi = brbr + bibi,
+           armai = arar - aiai, arpai = arar + aiai, tmp[3];
+
+    tmp[0] = ( armai - brmbi)*m[0] + ( arai2 - brbi2)*m[1] + ( arbr2 + aibi2)*m[2];
+    tmp[1] = (-arai2 - brbi2)*m[0] + ( armai + brmbi)*m[1] + ( arbi2 - aibr2)*m[2];
+    tmp[2] = (-arbr2 + aibi2)*m[0] + (-aibr2 - arbi2)*m[1] + ( arpai - brpbi)*m[2];
+
+    m[0] = tmp[0];
+    m[1] = tmp[1];
+    m[2] = tmp[2];
+
+}
+
+/*
+ * rotmn on floatv lanes; lanes without rotation get the identity
+ */
+void rotmnv (const floatv *n, floatv *m) {
+
+    floatv phi = sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]), hp = .5f*phi,
+           sp  = select (sin(hp)/phi, (floatv)(0.f), phi == 0.f);
+
+    ckrotv (cos(hp), -n[2]*sp, n[1]*sp, -n[0]*sp, m);
+
+}
+
+/*
+ * precess on floatv lanes
+ */
+void precessv (const floatv phi, floatv *m) {
+
+    floatv c, s = sincos (phi, &c), tmp;
+
+    tmp  = c*m[0] - s*m[1];
+    m[1] = s*m[0] + c*m[1];
+    m[0] = tmp;
+
+}
+
+/*
+ * spmul (ab = ab2 after ab) and rotsp on floatv lanes
+ */
+void spmulv (const floatv *ab2, floatv *ab) {
+
+    floatv tmp[4];
+
+    tmp[0] = ab2[0]*ab[0] - ab2[1]*ab[1] - ab2[2]*ab[2] - ab2[3]*ab[3];
+    tmp[1] = ab2[0]*ab[1] + ab2[1]*ab[0] - ab2[2]*ab[3] + ab2[3]*ab[2];
+    tmp[2] = ab2[2]*ab[0] - ab2[3]*ab[1] + ab2[0]*ab[2] + ab2[1]*ab[3];
+    tmp[3] = ab2[2]*ab[1] + ab2[3]*ab[0] + ab2[0]*ab[3] - ab2[1]*ab[2];
+
+    ab[0] = tmp[0];
+    ab[1] = tmp[1];
+    ab[2] = tmp[2];
+    ab[3] = tmp[3];
+
+}
+
+void rotspv (const floatv *n, floatv *ab) {
+
+    floatv phi = sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]), st[4],
+           sp  = select (sincos(.5f*phi, &st[0])/phi, (floatv)(0.f), phi == 0.f);
+
+    st[1] = -n[2]*sp;
+    st[2] =  n[1]*sp;
+    st[3] = -n[0]*sp;
+
+    spmulv (st, ab);
+
+}
+
+/*
+ * Voxel values a(pos, k) of this work-item's lanes (0 past nr)
+ */
+#define VGATHER(dst,expr) {                                     \
+        for (v = 0; v < VPI; ++v) {                             \
+            pos  = pos0 + v;                                    \
+            a[v] = (pos < nr) ? (expr) : 0.f;                   \
+        }                                                       \
+        dst = vloadv (0, a);                                    \
+    }
+
+/*
+ * simacq for VPI voxels per work-item
+ */
+__kernel void simacqvec (const __global float* b1, const     GMEM float*  g, const __global float* r,
+                         const __global float* b0, const __global float* gs, const __global float* m0,
+                         const __global float* ic, const       unsigned  nr, const       unsigned  nc,
+                         const       unsigned  nk, const          float  dt,       __global float* rf) {
+
+    unsigned pos0 = VPI*get_global_id(0), pos, v, k, c, t, t3;
+    float    a[VPI], s[VPI], on[VPI], any = 0.;
+    floatv   lm[3], lr[3], lb0, nv[3], tmp[2];
+    floatv   lsr[MAXNC], lsi[MAXNC]; /* Local sensitivity */
+
+    float gdt = GAMMA * TWOPI* DTS;
+    float rdt = 1.0e-3 * DTS * TWOPI;
+
+    for (k = 0; k < 3; ++k) {
+        VGATHER (lm[k], VOX(m0,pos,k)*ic[pos]);
+        VGATHER (lr[k], VOX(r,pos,k)*VOX(gs,pos,k));
+    }
+    VGATHER (lb0, b0[pos]);
+
+    vstorev (lm[0] + lm[1] + lm[2], 0, s);
+    for (v = 0; v < VPI; ++v)            // Simulate only non-zero voxels
+        any += (on[v] = (pos0 + v < nr && s[v] > 0.0));
+    if (!any)
+        return;
+
+    for (c = 0; c < NCH; ++c) {
+        VGATHER (lsr[c], b1[  2*(pos+c*nr)]);
+        VGATHER (lsi[c], b1[1+2*(pos+c*nr)]);
+    }
+
+    nv[0] = nv[1] = (floatv)(0.f);
+
+    for (t = 0, t3 = (NKT-1)*3; t < NKT; ++t, t3 -= 3) {
+
+        tmp[0] = lm[0];
+        tmp[1] = lm[1];
+
+        nv[2] = - gdt * (-g[  t3]*lr[0] +
+                         -g[1+t3]*lr[1] +
+                         -g[2+t3]*lr[2] - t * rdt * lb0);
+#ifdef PRECESS
+        precessv (nv[2], lm);
+#else
+        rotmnv (nv, lm);
+#endif
+
+        tmp[0] += lm[0];
+        tmp[1] += lm[1];
+
+        for (c = 0; c < NCH; ++c) {
+            vstorev (tmp[0]*lsr[c] + tmp[1]*lsi[c], 0, s);
+            for (v = 0; v < VPI; ++v)
+                if (on[v]) {
+                    unsigned stcnk = 2*((NKT-1-t) + (pos0+v)*NKT*NCH + c*NKT);
+                    rf[stcnk  ] = s[v];
+                    rf[stcnk+1] = s[v];
+                }
+        }
+
+    }
+
+}
+
+/*
+ * simexc for VPI voxels per work-item
+ */
+__kernel void simexcvec (const __global float* b1, const     GMEM float*  g, const    RFMEM float* rf,
+                         const __global float*  r, const __global float* b0, const __global float* gs,
+                         const __global float* m0, const unsigned nr, const unsigned nc, const unsigned nk,
+                         const float dt, __global float* m) {
+
+    unsigned pos0 = VPI*get_global_id(0), pos, v, k, c, t;
+    float    a[VPI], s[VPI], on[VPI];
+    floatv   lm[3], lr[3], lb0, nv[3];
+    floatv   lsr[MAXNC], lsi[MAXNC]; /* Local sensitivity */
+
+    float  gdt = GAMMA * TWOPI * DTS;
+    float  rdt = 1.0e-3 * DTS * TWOPI;
+#ifdef SPINOR
+    floatv ab[4] = {(floatv)(1.f), (floatv)(0.f), (floatv)(0.f), (floatv)(0.f)};
+#endif
+
+    for (k = 0; k < 3; ++k) {
+        VGATHER (lm[k], VOX(m0,pos,k));
+        VGATHER (lr[k], VOX(r,pos,k)*VOX(gs,pos,k));
+    }
+    VGATHER (lb0, b0[pos]);
+    for (c = 0; c < NCH; ++c) {
+        VGATHER (lsr[c], b1[  2*(pos+c*nr)]);
+        VGATHER (lsi[c], b1[1+2*(pos+c*nr)]);
+    }
+
+    vstorev (lm[0] + lm[1] + lm[2], 0, s);
+    for (v = 0; v < VPI; ++v)
+        on[v] = (s[v] > 0.0);
+
+    for (t = 0; t < NKT; ++t) {
+
+        // Total rf at the sites; rf loads shared by the lanes
+        floatv rfsr = (floatv)(0.f), rfsi = (floatv)(0.f);
+        for (c = 0; c < NCH; ++c) {
+            float rr = rf[RFOS(t,c)], ri = rf[RFOS(t,c)+1];
+            rfsr += rr*lsr[c] - ri*lsi[c];
+            rfsi += rr*lsi[c] + ri*lsr[c];
+        }
+
+        nv[0] = - rdt *  rfsi;
+        nv[1] =   rdt *  rfsr;
+        nv[2] = - gdt * (g[3*t  ]*lr[0] +
+                         g[3*t+1]*lr[1] +
+                         g[3*t+2]*lr[2] - t*rdt*lb0);
+
+#ifdef SPINOR
+        rotspv (nv, ab);
+#else
+        rotmnv (nv, lm);
+#endif
+
+    }
+
+#ifdef SPINOR
+    ckrotv (ab[0], ab[1], ab[2], ab[3], lm);
+#endif
+
+    for (k = 0; k < 3; ++k) {
+        vstorev (lm[k], 0, s);
+        for (v = 0; v < VPI; ++v)
+            if (pos0 + v < nr)
+                VOX(m,pos0+v,k) = (on[v]) ? s[v] : 0.f;
+    }
+
+}
+#endif
+
+
+/*
+ * Iterative design (CGNR) on the small tip angle model of simexc: a kick
+ * rdt*sum_c b1_c rf_c(t) at step t, scaled by the longitudinal m0, then
+ * precession over the rest of the pulse (half of step t's own).
+ *
+ *   E:   y(r)    = rdt mz(r) sum_t exp(i phi_t(r)) sum_c b1_c(r) rf_c(t)
+ *   E^H: rf_c(t) = rdt sum_r mz(r) conj(b1_c(r)) exp(-i phi_t(r)) y(r)
+ *
+ * y is 2*nr, rf 2*nc*nk floats. Voxels with empty m0 are not modelled.
+ */
+__kernel void stafwd (const __global float* b1, const     GMEM float*  g, const __global float* rf,
+                      const __global float*  r, const __global float* b0, const __global float* gs,
+                      const __global float* m0, const unsigned nr, const unsigned nc, const unsigned nk,
+                      const float dt, __global float* y) {
+
+    unsigned pos = get_global_id(0);
+    float    acc[2] = {0.,0.};
+
+    if (VOX(m0,pos,0) + VOX(m0,pos,1) + VOX(m0,pos,2) > 0.0) {
+
+        float  ls[MAXNC][2]; /* Local sensitivity */
+        float  lr[3] = {VOX(r,pos,0)*VOX(gs,pos,0),VOX(r,pos,1)*VOX(gs,pos,1),VOX(r,pos,2)*VOX(gs,pos,2)};
+        float  gdt = GAMMA * TWOPI * DTS;
+        float  rdt = 1.0e-3 * DTS * TWOPI;
+        float  phi = 0., nz, cp, sp;
+        unsigned c;
+
+        for (c = 0; c < NCH; ++c) {
+            ls[c][0] = b1[2*(pos+c*nr)  ];
+            ls[c][1] = b1[2*(pos+c*nr)+1];
+        }
+
+        for (int t = NKT-1; t >= 0; --t) {   /* Backwards: phase to the end */
+
+            float rfsr = 0., rfsi = 0.;
+            for (c = 0; c < NCH; ++c) {
+                unsigned rfos = 2*(t+c*NKT);
+                rfsr += rf[rfos]*ls[c][0]-rf[rfos+1]*ls[c][1];
+                rfsi += rf[rfos]*ls[c][1]+rf[rfos+1]*ls[c][0];
+            }
+
+            nz   = - gdt * (g[3*t]*lr[0] + g[3*t+1]*lr[1] + g[3*t+2]*lr[2] - t*rdt*b0[pos]);
+            sp   = sincos (phi + .5f*nz, &cp);
+            phi += nz;
+
+            acc[0] += cp*rfsr - sp*rfsi;
+            acc[1] += sp*rfsr + cp*rfsi;
+
+        }
+
+        acc[0] *= rdt * VOX(m0,pos,2);
+        acc[1] *= rdt * VOX(m0,pos,2);
+
+    }
+
+    y[2*pos  ] = acc[0];
+    y[2*pos+1] = acc[1];
+
+}
+
+/*
+ * E^H per voxel into srep (layout of simacq, not time reversed); sumsig
+ * completes it
+ */
+__kernel void staadj (const __global float* b1, const     GMEM float*  g, const __global float* y,
+                      const __global float*  r, const __global float* b0, const __global float* gs,
+                      const __global float* m0, const unsigned nr, const unsigned nc, const unsigned nk,
+                      const float dt, __global float* srep) {
+
+    unsigned pos = get_global_id(0);
+    unsigned  st = pos*NKT*NCH;
+    unsigned   c;
+
+    if (VOX(m0,pos,0) + VOX(m0,pos,1) + VOX(m0,pos,2) > 0.0) {
+
+        float  ls[MAXNC][2]; /* Local sensitivity */
+        float  lr[3] = {VOX(r,pos,0)*VOX(gs,pos,0),VOX(r,pos,1)*VOX(gs,pos,1),VOX(r,pos,2)*VOX(gs,pos,2)};
+        float  gdt = GAMMA * TWOPI * DTS;
+        float  rdt = 1.0e-3 * DTS * TWOPI;
+        float  ly[2] = {rdt*VOX(m0,pos,2)*y[2*pos], rdt*VOX(m0,pos,2)*y[2*pos+1]};
+        float  phi = 0., nz, cp, sp, sr, si;
+
+        for (c = 0; c < NCH; ++c) {
+            ls[c][0] = b1[2*(pos+c*nr)  ];
+            ls[c][1] = b1[2*(pos+c*nr)+1];
+        }
+
+        for (int t = NKT-1; t >= 0; --t) {
+
+            nz   = - gdt * (g[3*t]*lr[0] + g[3*t+1]*lr[1] + g[3*t+2]*lr[2] - t*rdt*b0[pos]);
+            sp   = sincos (phi + .5f*nz, &cp);
+            phi += nz;
+
+            sr   = cp*ly[0] + sp*ly[1];      /* exp(-i phi) y */
+            si   = cp*ly[1] - sp*ly[0];
+
+            for (c = 0; c < NCH; ++c) {      /* conj(b1) */
+                unsigned stcnk = 2*(st+t+c*NKT);
+                srep[stcnk  ] = ls[c][0]*sr + ls[c][1]*si;
+                srep[stcnk+1] = ls[c][0]*si - ls[c][1]*sr;
+            }
+
+        }
+
+    } else
+        for (c = 0; c < 2*NCH*NKT; ++c)
+            srep[2*st+c] = 0.;
+
+}
+
+/*
+ * Sum of the voxels' signals, as redsig without the Jacobian
+ */
+__kernel void sumsig (const __global float* srep, const unsigned nc, const unsigned nk,
+                      const unsigned nr, __global float* rf) {
+    unsigned sample = get_global_id(0);
+    unsigned slen   = 2*NCH*NKT;
+    float    acc    = 0.;
+    for (unsigned r = 0; r < nr*slen; r += slen)
+        acc += srep[r + sample];
+    rf[sample] = acc;
+}
+
+/*
+ * E^H summed over each work-group's voxels into one partial signal, as
+ * staadj with the tiling of simacqred; sumsig over the groups completes it
+ * (--fused, no nc*nk*nr signal buffer)
+ *
+ * tl:   Time steps buffered in local memory per pass
+ * sig:  2*tl*get_local_size(0) floats of local memory
+ * sens: 2*nc*get_local_size(0) floats of local memory
+ * part: 2*nc*nk*get_num_groups(0) floats
+ */
+__kernel void staadjred (const __global float* b1, const     GMEM float*  g, const __global float* y,
+                         const __global float*  r, const __global float* b0, const __global float* gs,
+                         const __global float* m0, const unsigned nr, const unsigned nc, const unsigned nk,
+                         const float dt, const unsigned tl, __local float* sig, __local float* sens,
+                         __global float* part) {
+
+    unsigned lid  = get_local_id(0);
+    unsigned lsz  = get_local_size(0);
+    unsigned slen = 2*NCH*NKT;
+    __global float* prf = part + get_group_id(0)*slen; /* This group's signal */
+
+    float gdt = GAMMA * TWOPI * DTS;
+    float rdt = 1.0e-3 * DTS * TWOPI;
+
+    unsigned s, t, t0, tn, tt, c, v;
+
+    for (s = lid; s < slen; s += lsz)
+        prf[s] = 0.;
+    barrier(CLK_GLOBAL_MEM_FENCE);
+
+    for (unsigned base = get_group_id(0)*lsz; base < nr; base += get_global_size(0)) {
+
+        unsigned pos = base + lid;
+        float    lr[3] = {0.,0.,0.};
+        float    ly[2] = {0.,0.};
+        float    lb0 = 0., phi = 0., nz, cp, sp;
+        bool     active = false;
+
+        if (pos < nr) {
+            lr[0]  = VOX(r,pos,0)*VOX(gs,pos,0);
+            lr[1]  = VOX(r,pos,1)*VOX(gs,pos,1);
+            lr[2]  = VOX(r,pos,2)*VOX(gs,pos,2);
+            lb0    = b0[pos];
+            ly[0]  = rdt*VOX(m0,pos,2)*y[2*pos];
+            ly[1]  = rdt*VOX(m0,pos,2)*y[2*pos+1];
+            active = (VOX(m0,pos,0) + VOX(m0,pos,1) + VOX(m0,pos,2) > 0.0);
+        }
+
+        // Local sensitivities of this voxel tile (zero for idle voxels)
+        for (c = 0; c < NCH; ++c) {
+            unsigned b1os = 2*(pos+c*nr);
+            sens[2*(c*lsz+lid)  ] = active ? b1[  b1os] : 0.;
+            sens[2*(c*lsz+lid)+1] = active ? b1[1+b1os] : 0.;
+        }
+
+        for (t0 = 0; t0 < NKT; t0 += tl) {   /* Backwards: phase to the end */
+
+            tn = min(tl, NKT-t0);
+
+            // exp(-i phi) y for this tile of time steps
+            for (tt = 0; tt < tn; ++tt) {
+                t    = NKT-1-t0-tt;
+                nz   = - gdt * (g[3*t]*lr[0] + g[3*t+1]*lr[1] + g[3*t+2]*lr[2] - t*rdt*lb0);
+                sp   = sincos (phi + .5f*nz, &cp);
+                phi += nz;
+                sig[2*(tt*lsz+lid)  ] = active ? cp*ly[0] + sp*ly[1] : 0.;
+                sig[2*(tt*lsz+lid)+1] = active ? cp*ly[1] - sp*ly[0] : 0.;
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+
+            // conj(b1), summed over the tile; one (time step, channel) pair per work-item
+            for (s = lid; s < tn*NCH; s += lsz) {
+                float accr = 0., acci = 0.;
+                tt = s % tn;
+                c  = s / tn;
+                for (v = 0; v < lsz; ++v) {
+                    accr += sens[2*(c*lsz+v)]*sig[2*(tt*lsz+v)  ] + sens[2*(c*lsz+v)+1]*sig[2*(tt*lsz+v)+1];
+                    acci += sens[2*(c*lsz+v)]*sig[2*(tt*lsz+v)+1] - sens[2*(c*lsz+v)+1]*sig[2*(tt*lsz+v)  ];
+                }
+                unsigned stcnk = 2*((NKT-1-t0-tt)+c*NKT);
+                prf[stcnk  ] += accr;
+                prf[stcnk+1] += acci;
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+
+        }
+    }
+
+}
+
+/*
+ * First level of |a|^2 over a[0..n): every work-group sums the squares of
+ * its grid-strided share and tree-reduces them to part[get_group_id(0)];
+ * sumpart completes it. The work-group size must be a power of two.
+ * scratch: get_local_size(0) floats of local memory
+ */
+__kernel void norm2 (const __global float* a, const unsigned n, __local float* scratch,
+                     __global float* part) {
+
+    unsigned lid = get_local_id(0);
+    float    acc = 0.;
+
+    for (unsigned i = get_global_id(0); i < n; i += get_global_size(0))
+        acc += a[i]*a[i];
+    scratch[lid] = acc;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (unsigned h = get_local_size(0)/2; h > 0; h >>= 1) {
+        if (lid < h)
+            scratch[lid] += scratch[lid+h];
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (lid == 0)
+        part[get_group_id(0)] = scratch[0];
+
+}
+
+/*
+ * s[slot] = sum of part[0..n), in one work-group (second level of norm2);
+ * its size must be a power of two. scratch: get_local_size(0) floats
+ */
+__kernel void sumpart (const __global float* part, const unsigned n, __local float* scratch,
+                       __global float* s, const unsigned slot) {
+
+    unsigned lid = get_local_id(0);
+    float    acc = 0.;
+
+    for (unsigned i = lid; i < n; i += get_local_size(0))
+        acc += part[i];
+    scratch[lid] = acc;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (unsigned h = get_local_size(0)/2; h > 0; h >>= 1) {
+        if (lid < h)
+            scratch[lid] += scratch[lid+h];
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (lid == 0)
+        s[slot] = scratch[0];
+
+}
+
+/*
+ * y += sign * s[num]/s[den] * x, the step read from device scalars
+ */
+__kernel void axpy (__global float* y, const __global float* x, const __global float* s,
+                    const unsigned num, const unsigned den, const float sign, const unsigned n) {
+    unsigned i = get_global_id(0);
+    if (i < n)
+        y[i] += sign * s[num]/s[den] * x[i];
+}
+
+/*
+ * p = z + s[num]/s[den] * p
+ */
+__kernel void xpay (__global float* p, const __global float* z, const __global float* s,
+                    const unsigned num, const unsigned den, const unsigned n) {
+    unsigned i = get_global_id(0);
+    if (i < n)
+        p[i] = z[i] + s[num]/s[den] * p[i];
+}